@@ -0,0 +1,166 @@
+#include <fcntl.h>      // For open()
+#include <errno.h>      // For errno and ESTALE
+#include <pthread.h>    // For pthread_create() and pthread_join()
+#include <stdio.h>      // For perror(), printf() and fprintf()
+#include <stdlib.h>     // For exit(), calloc(), free(), strtoul() and EXIT_FAILURE
+#include <stdint.h>     // For uint64_t and uintptr_t
+#include <time.h>       // For clock_gettime()
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For write() and close()
+#include "message_slot.h"
+
+// Compare-and-swap contention benchmark: threads increment a counter kept in one channel
+// with a read, MSG_SLOT_CAS loop, the way a lock-free register protocol would. A lost
+// race fails with ESTALE and is retried. The final counter must equal the number of
+// increments. Reports increments per second and retries per increment.
+
+#define DEFAULT_THREADS 8
+#define DEFAULT_INCREMENTS 100000   // Per thread
+#define CHANNEL_ID 1
+
+struct worker {
+    pthread_t thread;
+    const char *path;
+    unsigned long increments;
+    unsigned long retries;
+};
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reads the counter and the sequence number of the message holding it
+static uint64_t read_counter(int fd, uint64_t *seq) {
+    struct msg_slot_read req;
+    uint64_t value;
+
+    req.channel_id = CHANNEL_ID;
+    req.len = sizeof(value);
+    req.seq = 0;
+    req.buf = (uintptr_t)&value;
+    if (ioctl(fd, MSG_SLOT_READ_IF_NEWER, &req) != 0 || req.len != sizeof(value)) {
+        fail("Error reading the counter");
+    }
+    *seq = req.seq;
+    return value;
+}
+
+static void *run_worker(void *arg) {
+    struct worker *w = arg;
+    struct msg_slot_cas cas;
+    uint64_t value;
+    uint64_t seq;
+    unsigned long i;
+    int fd;
+
+    fd = open(w->path, O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+
+    cas.channel_id = CHANNEL_ID;
+    cas.len = sizeof(value);
+    cas.buf = (uintptr_t)&value;
+    for (i = 0; i < w->increments; i++) {
+        value = read_counter(fd, &seq) + 1;
+        cas.expected_seq = seq;
+        while (ioctl(fd, MSG_SLOT_CAS, &cas) != 0) {
+            if (errno != ESTALE) {
+                fail("Error swapping the counter");
+            }
+            // Another thread won, retry on top of its value
+            w->retries++;
+            value = read_counter(fd, &seq) + 1;
+            cas.expected_seq = seq;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    struct worker *workers;
+    unsigned int threads = DEFAULT_THREADS;
+    unsigned long increments = DEFAULT_INCREMENTS;
+    unsigned long retries = 0;
+    uint64_t value = 0;
+    uint64_t seq;
+    unsigned int t;
+    double start;
+    double elapsed;
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <device file path> [threads] [increments per thread]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        threads = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        increments = strtoul(argv[3], NULL, 10);
+    }
+    if (threads == 0 || increments == 0) {
+        fprintf(stderr, "Need at least 1 thread and 1 increment\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file and start the counter at 0
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    if (ioctl(fd, MSG_SLOT_CHANNEL, CHANNEL_ID) != 0 || write(fd, &value, sizeof(value)) != sizeof(value)) {
+        fail("Error creating the counter");
+    }
+
+    workers = calloc(threads, sizeof(*workers));
+    if (!workers) {
+        fail("Error allocating threads");
+    }
+
+    start = now();
+    for (t = 0; t < threads; t++) {
+        workers[t].path = argv[1];
+        workers[t].increments = increments;
+        if (pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]) != 0) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        retries += workers[t].retries;
+    }
+    elapsed = now() - start;
+
+    value = read_counter(fd, &seq);
+    if (ioctl(fd, MSG_SLOT_DELETE, CHANNEL_ID) != 0) {
+        fail("Error deleting the counter");
+    }
+
+    printf("%lu increments by %u threads in %.2f s: %.0f increments/s, %.2f retries per increment\n",
+           increments * threads, threads, elapsed, increments * threads / elapsed,
+           (double)retries / (increments * threads));
+
+    if (value != (uint64_t)increments * threads) {
+        fprintf(stderr, "Counter is %llu, expected %llu\n", (unsigned long long)value,
+                (unsigned long long)increments * threads);
+        exit(EXIT_FAILURE);
+    }
+
+    free(workers);
+    close(fd);
+
+    return 0;
+}
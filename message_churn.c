@@ -0,0 +1,189 @@
+#include <fcntl.h>      // For open()
+#include <pthread.h>    // For pthread_create() and pthread_join()
+#include <stdio.h>      // For perror(), printf(), fprintf() and snprintf()
+#include <stdlib.h>     // For exit(), calloc(), strtoul() and EXIT_FAILURE
+#include <time.h>       // For clock_gettime()
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For write() and close()
+#include "message_slot.h"
+
+// Benchmarks the session-per-channel pattern: every thread keeps a window of live
+// channels, creating a channel by writing to it and deleting the oldest one, for
+// millions of sessions. The slot's channel count and memory are sampled as it runs and
+// must be back at their starting values once every channel is deleted.
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_SESSIONS 4000000   // Channels created and deleted over the whole run
+#define DEFAULT_WINDOW 10000       // Live channels per thread
+#define SAMPLE_USEC 500000         // Time between two samples of the slot
+
+struct worker {
+    pthread_t thread;
+    const char *path;
+    unsigned int first_id;  // Thread t uses the IDs first_id to first_id + window * 2
+    unsigned int window;
+    unsigned long sessions;
+    unsigned long errors;
+    int done;
+};
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void read_stats(int fd, struct msg_slot_stats *stats) {
+    if (ioctl(fd, MSG_SLOT_STATS, stats) != 0) {
+        fail("Error reading slot stats");
+    }
+}
+
+// Session i lives in channel first_id + i % (window * 2), so the ID it reuses was
+// deleted window sessions earlier
+static void *run_worker(void *arg) {
+    struct worker *w = arg;
+    unsigned int span = w->window * 2;
+    unsigned long i;
+    char msg[64];
+    int len;
+    int fd;
+
+    fd = open(w->path, O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+
+    for (i = 0; i < w->sessions + w->window; i++) {
+        if (i < w->sessions) {
+            len = snprintf(msg, sizeof(msg), "session %lu", i);
+            if (ioctl(fd, MSG_SLOT_CHANNEL, w->first_id + i % span) != 0 || write(fd, msg, len) != len) {
+                w->errors++;
+            }
+        }
+        if (i >= w->window && ioctl(fd, MSG_SLOT_DELETE, w->first_id + (i - w->window) % span) != 0) {
+            w->errors++;
+        }
+    }
+
+    close(fd);
+    __atomic_store_n(&w->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Returns whether every thread has finished its sessions
+static int all_done(struct worker *workers, unsigned int threads) {
+    unsigned int t;
+
+    for (t = 0; t < threads; t++) {
+        if (!__atomic_load_n(&workers[t].done, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    struct msg_slot_stats before;
+    struct msg_slot_stats stats;
+    struct worker *workers;
+    unsigned int threads = DEFAULT_THREADS;
+    unsigned long sessions = DEFAULT_SESSIONS;
+    unsigned int window = DEFAULT_WINDOW;
+    unsigned int t;
+    unsigned long errors = 0;
+    unsigned long long peak = 0;
+    double start;
+    double elapsed;
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 5) {
+        fprintf(stderr, "Usage: %s <device file path> [threads] [sessions] [window]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        threads = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        sessions = strtoul(argv[3], NULL, 10);
+    }
+    if (argc > 4) {
+        window = strtoul(argv[4], NULL, 10);
+    }
+    if (threads == 0 || window == 0 || sessions < threads) {
+        fprintf(stderr, "Need at least 1 thread, 1 session per thread and a window of 1\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    read_stats(fd, &before);
+    if (before.channel_count != 0) {
+        fprintf(stderr, "The slot must be empty\n");
+        exit(EXIT_FAILURE);
+    }
+
+    workers = calloc(threads, sizeof(*workers));
+    if (!workers) {
+        fail("Error allocating threads");
+    }
+
+    start = now();
+    for (t = 0; t < threads; t++) {
+        workers[t].path = argv[1];
+        workers[t].first_id = 1 + t * window * 2;
+        workers[t].window = window;
+        workers[t].sessions = sessions / threads;
+        if (pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]) != 0) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Sample the slot while the threads churn, both values should level off
+    printf("%-10s %-14s %-14s\n", "seconds", "channel_count", "mem_used");
+    while (!all_done(workers, threads)) {
+        usleep(SAMPLE_USEC);
+        read_stats(fd, &stats);
+        if (stats.mem_used > peak) {
+            peak = stats.mem_used;
+        }
+        printf("%-10.2f %-14llu %-14llu\n", now() - start, (unsigned long long)stats.channel_count,
+               (unsigned long long)stats.mem_used);
+    }
+
+    for (t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        errors += workers[t].errors;
+    }
+    elapsed = now() - start;
+    read_stats(fd, &stats);
+
+    printf("%lu sessions by %u threads in %.2f s, %.0f sessions/s, peak mem_used %llu bytes\n",
+           workers[0].sessions * threads, threads, elapsed, workers[0].sessions * threads / elapsed, peak);
+
+    if (errors) {
+        fprintf(stderr, "%lu failed writes or deletions\n", errors);
+        exit(EXIT_FAILURE);
+    }
+    if (stats.channel_count != before.channel_count || stats.mem_used != before.mem_used) {
+        fprintf(stderr, "Slot did not return to its starting state: %llu channels, %llu bytes\n",
+                (unsigned long long)stats.channel_count, (unsigned long long)stats.mem_used);
+        exit(EXIT_FAILURE);
+    }
+
+    free(workers);
+    close(fd);
+
+    return 0;
+}
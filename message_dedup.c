@@ -0,0 +1,191 @@
+#include <fcntl.h>      // For open()
+#include <stdio.h>      // For perror(), printf() and fprintf()
+#include <stdlib.h>     // For exit(), malloc(), free(), strtoul() and EXIT_FAILURE
+#include <string.h>     // For memset() and memcmp()
+#include <stdint.h>     // For uint32_t and uintptr_t
+#include <time.h>       // For clock_gettime()
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For read(), write() and close()
+#include "message_slot.h"
+
+// Shared payload benchmark: writes one message to many channels of an empty slot, once
+// with a write() per channel and once with MSG_SLOT_WRITE_MANY, and compares the slot's
+// mem_used and the time taken. Then overwrites one channel and checks that only it
+// changed, since the others still share the old payload.
+
+#define DEFAULT_CHANNELS 10000
+#define DEFAULT_LEN 4096
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long mem_used(int fd) {
+    struct msg_slot_stats stats;
+
+    if (ioctl(fd, MSG_SLOT_STATS, &stats) != 0) {
+        fail("Error reading slot stats");
+    }
+    return stats.mem_used;
+}
+
+static void delete_channels(int fd, unsigned int channels) {
+    unsigned int id;
+
+    for (id = 1; id <= channels; id++) {
+        if (ioctl(fd, MSG_SLOT_DELETE, id) != 0) {
+            fail("Error deleting channel");
+        }
+    }
+}
+
+static void write_each(int fd, const char *msg, size_t len, unsigned int channels) {
+    unsigned int id;
+
+    for (id = 1; id <= channels; id++) {
+        if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0 || write(fd, msg, len) != (ssize_t)len) {
+            fail("Error writing message");
+        }
+    }
+}
+
+// Writes the message to the channels in calls of at most MSG_SLOT_WRITE_MANY_MAX IDs
+static void write_many(int fd, const char *msg, size_t len, uint32_t *ids, unsigned int channels) {
+    struct msg_slot_write_many req;
+    unsigned int done = 0;
+    unsigned int count;
+
+    while (done < channels) {
+        count = channels - done < MSG_SLOT_WRITE_MANY_MAX ? channels - done : MSG_SLOT_WRITE_MANY_MAX;
+        req.count = count;
+        req.len = len;
+        req.buf = (uintptr_t)msg;
+        req.channel_ids = (uintptr_t)(ids + done);
+        if (ioctl(fd, MSG_SLOT_WRITE_MANY, &req) != 0 || req.count != count) {
+            fail("Error writing to many channels");
+        }
+        done += count;
+    }
+}
+
+static int holds(int fd, unsigned int id, const char *msg, char *buf, size_t len) {
+    if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0) {
+        fail("Error setting channel id");
+    }
+    return read(fd, buf, len) == (ssize_t)len && memcmp(buf, msg, len) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct msg_slot_stats stats;
+    unsigned int channels = DEFAULT_CHANNELS;
+    size_t len = DEFAULT_LEN;
+    unsigned long long base;
+    unsigned long long each_mem;
+    unsigned long long many_mem;
+    double each_s;
+    double many_s;
+    double start;
+    uint32_t *ids;
+    unsigned int id;
+    char *msg;
+    char *other;
+    char *buf;
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <device file path> [channels] [message len]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        channels = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        len = strtoul(argv[3], NULL, 10);
+    }
+    if (channels < 2 || len == 0) {
+        fprintf(stderr, "Need at least 2 channels and a message of 1 byte\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    if (ioctl(fd, MSG_SLOT_STATS, &stats) != 0) {
+        fail("Error reading slot stats");
+    }
+    if (stats.channel_count != 0) {
+        fprintf(stderr, "The slot must be empty\n");
+        exit(EXIT_FAILURE);
+    }
+    base = stats.mem_used;
+
+    ids = malloc(channels * sizeof(*ids));
+    msg = malloc(len);
+    other = malloc(len);
+    buf = malloc(len);
+    if (!ids || !msg || !other || !buf) {
+        fail("Error allocating buffers");
+    }
+    for (id = 1; id <= channels; id++) {
+        ids[id - 1] = id;
+    }
+    memset(msg, 'm', len);
+    memset(other, 'o', len);
+
+    // One copy per channel
+    start = now();
+    write_each(fd, msg, len, channels);
+    each_s = now() - start;
+    each_mem = mem_used(fd) - base;
+    delete_channels(fd, channels);
+
+    // One copy shared by every channel
+    start = now();
+    write_many(fd, msg, len, ids, channels);
+    many_s = now() - start;
+    many_mem = mem_used(fd) - base;
+
+    // A write to one channel must leave the shared copy of the others alone
+    id = channels / 2;
+    if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0 || write(fd, other, len) != (ssize_t)len) {
+        fail("Error overwriting a channel");
+    }
+    if (!holds(fd, id, other, buf, len) || !holds(fd, 1, msg, buf, len) ||
+        !holds(fd, channels, msg, buf, len)) {
+        fprintf(stderr, "Overwriting channel %u changed the other channels or missed it\n", id);
+        exit(EXIT_FAILURE);
+    }
+    delete_channels(fd, channels);
+
+    printf("%u channels, %zu byte message\n", channels, len);
+    printf("%-20s %-14s %-14s %-10s\n", "", "mem_used", "per channel", "writes/s");
+    printf("%-20s %-14llu %-14.0f %-10.0f\n", "write() each", each_mem, (double)each_mem / channels,
+           channels / each_s);
+    printf("%-20s %-14llu %-14.0f %-10.0f\n", "MSG_SLOT_WRITE_MANY", many_mem,
+           (double)many_mem / channels, channels / many_s);
+    printf("Saved %.1f%% of the memory\n", 100.0 - 100.0 * many_mem / each_mem);
+
+    if (mem_used(fd) != base) {
+        fprintf(stderr, "mem_used is %llu after deleting every channel\n", mem_used(fd));
+        exit(EXIT_FAILURE);
+    }
+
+    free(buf);
+    free(other);
+    free(msg);
+    free(ids);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,254 @@
+#include <fcntl.h>          // For open()
+#include <errno.h>          // For errno and EWOULDBLOCK
+#include <pthread.h>        // For pthread_create(), pthread_join() and pthread_attr_setstacksize()
+#include <sched.h>          // For sched_yield()
+#include <stdio.h>          // For perror(), printf() and fprintf()
+#include <stdlib.h>         // For exit(), malloc(), calloc(), free(), strtoul() and EXIT_FAILURE
+#include <stdint.h>         // For uint32_t, uint64_t and uintptr_t
+#include <time.h>           // For clock_gettime()
+#include <sys/ioctl.h>      // For ioctl()
+#include <sys/resource.h>   // For getrlimit() and setrlimit()
+#include <unistd.h>         // For read(), write() and close()
+#include "message_slot.h"
+
+// Broadcast benchmark: one writer appends numbered messages to a broadcast channel and
+// many readers, each on its own open file, read every one of them through their own
+// cursor. Readers sleep on a notification fd when they have caught up. The writer never
+// gets further ahead of the slowest reader than the log holds, so every reader must see
+// every message exactly once and in order. Reports the write rate and the deliveries
+// per second across all readers.
+
+#define DEFAULT_READERS 1000
+#define DEFAULT_MESSAGES 100000
+#define DEFAULT_LEN 256
+#define DEPTH 1024              // Log depth, the writer waits for readers every DEPTH / 2 messages
+#define CHANNEL_ID 1
+#define READER_STACK (64 << 10)
+
+struct reader {
+    pthread_t thread;
+    const char *path;
+    unsigned long messages;
+    size_t len;
+    uint64_t next;              // Number of the next message expected, read by the writer
+    unsigned long errors;       // Messages missing, repeated or out of order
+};
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void read_stats(int fd, struct msg_slot_stats *stats) {
+    if (ioctl(fd, MSG_SLOT_STATS, stats) != 0) {
+        fail("Error reading slot stats");
+    }
+}
+
+// Every reader holds the device file and a notification fd
+static void raise_fd_limit(unsigned int readers) {
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+        fail("Error reading the open file limit");
+    }
+    if (rl.rlim_cur < readers * 2 + 16) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur < readers * 2 + 16) {
+            fprintf(stderr, "The open file limit is too low for %u readers\n", readers);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Drains the channel, then sleeps on the notification fd until the writer appends more
+static void *run_reader(void *arg) {
+    struct reader *r = arg;
+    struct msg_slot_subscribe sub;
+    uint32_t id = CHANNEL_ID;
+    uint32_t changed[16];
+    uint64_t *msg;
+    ssize_t n;
+    int fd;
+
+    msg = malloc(r->len);
+    if (!msg) {
+        fail("Error allocating buffer");
+    }
+    fd = open(r->path, O_RDONLY);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    if (ioctl(fd, MSG_SLOT_CHANNEL, CHANNEL_ID) != 0) {
+        fail("Error setting channel id");
+    }
+    sub.fd = -1;
+    sub.count = 1;
+    sub.channel_ids = (uintptr_t)&id;
+    sub.fd = ioctl(fd, MSG_SLOT_SUBSCRIBE, &sub);
+    if (sub.fd < 0) {
+        fail("Error subscribing to the channel");
+    }
+
+    while (r->next < r->messages) {
+        n = read(fd, msg, r->len);
+        if (n < 0 && errno == EWOULDBLOCK) {
+            // Caught up, a write since the last notification wakes the read at once
+            if (read(sub.fd, changed, sizeof(changed)) < 0) {
+                fail("Error waiting for a notification");
+            }
+            continue;
+        }
+        if (n != (ssize_t)r->len) {
+            fail("Error reading message");
+        }
+        if (msg[0] != r->next) {
+            r->errors++;
+        }
+        __atomic_store_n(&r->next, msg[0] + 1, __ATOMIC_RELEASE);
+    }
+
+    close(sub.fd);
+    close(fd);
+    free(msg);
+    return NULL;
+}
+
+// Waits until every reader has read past message first
+static void wait_readers(struct reader *readers, unsigned int count, uint64_t first) {
+    unsigned int t;
+
+    for (t = 0; t < count; t++) {
+        while (__atomic_load_n(&readers[t].next, __ATOMIC_ACQUIRE) < first) {
+            sched_yield();
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct msg_slot_broadcast broadcast;
+    struct msg_slot_stats stats;
+    struct reader *readers;
+    pthread_attr_t attr;
+    unsigned int count = DEFAULT_READERS;
+    unsigned long messages = DEFAULT_MESSAGES;
+    size_t len = DEFAULT_LEN;
+    unsigned long errors = 0;
+    unsigned long long log_mem;
+    uint64_t *msg;
+    uint64_t i;
+    unsigned int t;
+    double start;
+    double write_s;
+    double elapsed;
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 5) {
+        fprintf(stderr, "Usage: %s <device file path> [readers] [messages] [message len]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        count = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        messages = strtoul(argv[3], NULL, 10);
+    }
+    if (argc > 4) {
+        len = strtoul(argv[4], NULL, 10);
+    }
+    if (count == 0 || messages == 0 || len < sizeof(uint64_t)) {
+        fprintf(stderr, "Need at least 1 reader, 1 message and a message of %zu bytes\n", sizeof(uint64_t));
+        exit(EXIT_FAILURE);
+    }
+    raise_fd_limit(count);
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    read_stats(fd, &stats);
+    if (stats.channel_count != 0) {
+        fprintf(stderr, "The slot must be empty\n");
+        exit(EXIT_FAILURE);
+    }
+
+    msg = calloc(1, len);
+    readers = calloc(count, sizeof(*readers));
+    if (!msg || !readers) {
+        fail("Error allocating buffers");
+    }
+
+    // Create the channel and turn it into a broadcast channel
+    if (ioctl(fd, MSG_SLOT_CHANNEL, CHANNEL_ID) != 0 || write(fd, msg, len) != (ssize_t)len) {
+        fail("Error creating the channel");
+    }
+    broadcast.channel_id = CHANNEL_ID;
+    broadcast.depth = DEPTH;
+    if (ioctl(fd, MSG_SLOT_SET_BROADCAST, &broadcast) != 0) {
+        fail("Error setting broadcast mode");
+    }
+
+    // A new file's cursor starts at the oldest logged message, and the writer waits for
+    // readers that have not opened their file yet, so readers may start late
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, READER_STACK);
+    for (t = 0; t < count; t++) {
+        readers[t].path = argv[1];
+        readers[t].messages = messages;
+        readers[t].len = len;
+        if (pthread_create(&readers[t].thread, &attr, run_reader, &readers[t]) != 0) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    start = now();
+    for (i = 0; i < messages; i++) {
+        if (i % (DEPTH / 2) == 0 && i >= DEPTH / 2) {
+            wait_readers(readers, count, i - DEPTH / 2);
+        }
+        msg[0] = i;
+        if (write(fd, msg, len) != (ssize_t)len) {
+            fail("Error writing message");
+        }
+    }
+    write_s = now() - start;
+    read_stats(fd, &stats);
+    log_mem = stats.mem_used;
+
+    for (t = 0; t < count; t++) {
+        pthread_join(readers[t].thread, NULL);
+        errors += readers[t].errors;
+    }
+    elapsed = now() - start;
+
+    if (ioctl(fd, MSG_SLOT_DELETE, CHANNEL_ID) != 0) {
+        fail("Error deleting the channel");
+    }
+
+    printf("%lu messages of %zu bytes to %u readers in %.2f s\n", messages, len, count, elapsed);
+    printf("Writer: %.0f messages/s, readers: %.0f deliveries/s\n", messages / write_s,
+           (double)messages * count / elapsed);
+    printf("mem_used with a log of %u messages: %llu bytes, independent of the readers\n", DEPTH, log_mem);
+
+    if (errors) {
+        fprintf(stderr, "%lu messages missed or seen out of order\n", errors);
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_attr_destroy(&attr);
+    free(readers);
+    free(msg);
+    close(fd);
+
+    return 0;
+}
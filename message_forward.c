@@ -0,0 +1,169 @@
+#define _GNU_SOURCE     // For splice() and F_SETPIPE_SZ
+#include <fcntl.h>      // For open(), splice() and fcntl()
+#include <errno.h>      // For errno and EMSGSIZE
+#include <stdio.h>      // For perror(), printf() and fprintf()
+#include <stdlib.h>     // For exit(), malloc(), calloc(), strtoul() and EXIT_FAILURE
+#include <string.h>     // For memset() and memcmp()
+#include <time.h>       // For clock_gettime()
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For read(), write(), pipe() and close()
+#include "message_slot.h"
+
+// Forwarding benchmark: moves a message from one channel to another many times, once
+// through a user buffer with read() and write() and once through a pipe with splice(),
+// and reports both rates. Checks that the forwarded message arrives whole and that a
+// splice longer than the pipe is refused with EMSGSIZE rather than truncated.
+
+#define DEFAULT_LEN 4096
+#define DEFAULT_MESSAGES 1000000
+#define SOURCE_ID 1
+#define TARGET_ID 2
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_channel(const char *path, unsigned int id) {
+    int fd;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0) {
+        fail("Error setting channel id");
+    }
+    return fd;
+}
+
+static double forward_copy(int src, int dst, char *buf, size_t len, unsigned long messages) {
+    unsigned long i;
+    double start = now();
+
+    for (i = 0; i < messages; i++) {
+        if (read(src, buf, len) != (ssize_t)len || write(dst, buf, len) != (ssize_t)len) {
+            fail("Error forwarding through a buffer");
+        }
+    }
+    return now() - start;
+}
+
+static double forward_splice(int src, int dst, int pipefd[2], size_t len, unsigned long messages) {
+    unsigned long i;
+    double start = now();
+
+    for (i = 0; i < messages; i++) {
+        if (splice(src, NULL, pipefd[1], NULL, len, 0) != (ssize_t)len ||
+            splice(pipefd[0], NULL, dst, NULL, len, 0) != (ssize_t)len) {
+            fail("Error forwarding through a pipe");
+        }
+    }
+    return now() - start;
+}
+
+// Fills a default sized pipe and splices twice its size into the target channel, which
+// the device must refuse instead of storing only what one batch carries
+static void check_oversized(int dst) {
+    int pipefd[2];
+    size_t size;
+    char *buf;
+
+    if (pipe(pipefd) != 0) {
+        fail("Error creating pipe");
+    }
+    size = fcntl(pipefd[0], F_GETPIPE_SZ);
+    buf = calloc(1, size);
+    if (!buf) {
+        fail("Error allocating buffer");
+    }
+    if (write(pipefd[1], buf, size) != (ssize_t)size) {
+        fail("Error filling pipe");
+    }
+    if (splice(pipefd[0], NULL, dst, NULL, size * 2, SPLICE_F_NONBLOCK) != -1 || errno != EMSGSIZE) {
+        fprintf(stderr, "A splice of %zu bytes through a %zu byte pipe was not refused\n", size * 2,
+                size);
+        exit(EXIT_FAILURE);
+    }
+    free(buf);
+    close(pipefd[0]);
+    close(pipefd[1]);
+}
+
+int main(int argc, char *argv[]) {
+    size_t len = DEFAULT_LEN;
+    unsigned long messages = DEFAULT_MESSAGES;
+    int pipefd[2];
+    char *expected;
+    char *buf;
+    double copy_s;
+    double splice_s;
+    int src;
+    int dst;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <device file path> [message len] [messages]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        len = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        messages = strtoul(argv[3], NULL, 10);
+    }
+    if (len == 0 || messages == 0) {
+        fprintf(stderr, "Need a message of at least 1 byte and 1 message\n");
+        exit(EXIT_FAILURE);
+    }
+
+    src = open_channel(argv[1], SOURCE_ID);
+    dst = open_channel(argv[1], TARGET_ID);
+
+    expected = malloc(len);
+    buf = malloc(len);
+    if (!expected || !buf) {
+        fail("Error allocating buffers");
+    }
+    memset(expected, 'f', len);
+    if (write(src, expected, len) != (ssize_t)len) {
+        fail("Error writing the source message");
+    }
+
+    // The whole message must fit in the pipe, see device_splice_write()
+    if (pipe(pipefd) != 0) {
+        fail("Error creating pipe");
+    }
+    if ((size_t)fcntl(pipefd[0], F_GETPIPE_SZ) < len && fcntl(pipefd[0], F_SETPIPE_SZ, len) < 0) {
+        fail("Error growing the pipe to the message length");
+    }
+
+    copy_s = forward_copy(src, dst, buf, len, messages);
+    splice_s = forward_splice(src, dst, pipefd, len, messages);
+
+    if (read(dst, buf, len) != (ssize_t)len || memcmp(buf, expected, len) != 0) {
+        fprintf(stderr, "The forwarded message differs from the source\n");
+        exit(EXIT_FAILURE);
+    }
+    check_oversized(dst);
+
+    printf("%lu messages of %zu bytes\n", messages, len);
+    printf("read+write: %.0f messages/s, %.2f GB/s\n", messages / copy_s, messages * len / copy_s / 1e9);
+    printf("splice:     %.0f messages/s, %.2f GB/s\n", messages / splice_s, messages * len / splice_s / 1e9);
+
+    free(buf);
+    free(expected);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    close(src);
+    close(dst);
+
+    return 0;
+}
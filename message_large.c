@@ -0,0 +1,157 @@
+#include <fcntl.h>      // For open()
+#include <stdio.h>      // For perror(), printf() and fprintf()
+#include <stdlib.h>     // For exit(), malloc(), free(), strtoul() and EXIT_FAILURE
+#include <string.h>     // For memcmp()
+#include <stdint.h>     // For uintptr_t
+#include <time.h>       // For clock_gettime()
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For read(), write() and close()
+#include "message_slot.h"
+
+// Large message benchmark: writes multi-MiB messages to one channel and reads them back
+// whole with read() and in chunks with MSG_SLOT_READ_AT, reporting each in GB/s. Every
+// message read is checked against the one written. The default length is the module's
+// default max_message_len.
+
+#define DEFAULT_LEN (4 << 20)
+#define DEFAULT_CHUNK (256 << 10)   // Bytes per MSG_SLOT_READ_AT call
+#define DEFAULT_ROUNDS 200
+#define CHANNEL_ID 1
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Message of round r, so a read that returned an older message is noticed
+static void fill_message(char *buf, size_t len, unsigned long r) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = (char)(r + i / 4096);
+    }
+}
+
+// Reads the channel's message chunk by chunk, all chunks of the same message
+static void read_chunks(int fd, char *buf, size_t len, size_t chunk) {
+    struct msg_slot_read_at req;
+    size_t offset = 0;
+
+    req.seq = 0;
+    while (offset < len) {
+        req.channel_id = CHANNEL_ID;
+        req.reserved = 0;
+        req.offset = offset;
+        req.buf = (uintptr_t)(buf + offset);
+        req.len = len - offset < chunk ? len - offset : chunk;
+        if (ioctl(fd, MSG_SLOT_READ_AT, &req) != 0) {
+            fail("Error reading a chunk");
+        }
+        if (req.message_len != len || req.len == 0) {
+            fprintf(stderr, "Chunk at %zu returned %llu bytes of a %llu byte message\n", offset,
+                    (unsigned long long)req.len, (unsigned long long)req.message_len);
+            exit(EXIT_FAILURE);
+        }
+        offset += req.len;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long rounds = DEFAULT_ROUNDS;
+    size_t len = DEFAULT_LEN;
+    size_t chunk = DEFAULT_CHUNK;
+    unsigned long r;
+    double write_s = 0;
+    double read_s = 0;
+    double chunk_s = 0;
+    double start;
+    double total;
+    char *expected;
+    char *actual;
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 5) {
+        fprintf(stderr, "Usage: %s <device file path> [message len] [chunk len] [rounds]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        len = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        chunk = strtoul(argv[3], NULL, 10);
+    }
+    if (argc > 4) {
+        rounds = strtoul(argv[4], NULL, 10);
+    }
+    if (len == 0 || chunk == 0 || rounds == 0) {
+        fprintf(stderr, "Need a message and a chunk of at least 1 byte and 1 round\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    if (ioctl(fd, MSG_SLOT_CHANNEL, CHANNEL_ID) != 0) {
+        fail("Error setting channel id");
+    }
+
+    expected = malloc(len);
+    actual = malloc(len);
+    if (!expected || !actual) {
+        fail("Error allocating buffers");
+    }
+
+    for (r = 0; r < rounds; r++) {
+        fill_message(expected, len, r);
+
+        start = now();
+        if (write(fd, expected, len) != (ssize_t)len) {
+            fail("Error writing message");
+        }
+        write_s += now() - start;
+
+        start = now();
+        if (read(fd, actual, len) != (ssize_t)len) {
+            fail("Error reading message");
+        }
+        read_s += now() - start;
+        if (memcmp(actual, expected, len) != 0) {
+            fprintf(stderr, "Round %lu: read() returned another message\n", r);
+            exit(EXIT_FAILURE);
+        }
+
+        start = now();
+        read_chunks(fd, actual, len, chunk);
+        chunk_s += now() - start;
+        if (memcmp(actual, expected, len) != 0) {
+            fprintf(stderr, "Round %lu: MSG_SLOT_READ_AT returned another message\n", r);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (ioctl(fd, MSG_SLOT_DELETE, CHANNEL_ID) != 0) {
+        fail("Error deleting the channel");
+    }
+
+    total = (double)len * rounds;
+    printf("%lu messages of %zu bytes, %zu byte chunks\n", rounds, len, chunk);
+    printf("write():           %.2f GB/s\n", total / write_s / 1e9);
+    printf("read():            %.2f GB/s\n", total / read_s / 1e9);
+    printf("MSG_SLOT_READ_AT:  %.2f GB/s\n", total / chunk_s / 1e9);
+
+    free(actual);
+    free(expected);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include <fcntl.h>      // For open()
+#include <stdio.h>      // For perror() and printf()
+#include <stdlib.h>     // For exit() and EXIT_FAILURE
+#include <string.h>     // For strcmp()
+#include <stdint.h>     // For uintptr_t
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For close()
+#include "message_slot.h"
+
+#define PAGE_ENTRIES 1024  // Channels requested per MSG_SLOT_LIST call
+
+int main(int argc, char *argv[]) {
+    int fd;
+    unsigned int i;
+    struct msg_slot_list list;
+    struct msg_slot_channel_info entries[PAGE_ENTRIES];
+
+    // Validate the command-line arguments
+    if (argc != 2 && !(argc == 3 && strcmp(argv[2], "--nonempty") == 0)) {
+        fprintf(stderr, "Usage: %s <device file path> [--nonempty]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening device file");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&list, 0, sizeof(list));
+    list.flags = (argc == 3) ? MSG_SLOT_LIST_NONEMPTY : 0;
+    list.entries = (uintptr_t)entries;
+
+    printf("%-12s %-12s %s\n", "channel_id", "message_len", "last_write_ns");
+
+    // Walk the slot page by page, the kernel advances the cursor for us
+    do {
+        list.count = PAGE_ENTRIES;
+        if (ioctl(fd, MSG_SLOT_LIST, &list) != 0) {
+            perror("Error listing channels");
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+
+        for (i = 0; i < list.count; i++) {
+            printf("%-12u %-12u %llu\n", entries[i].channel_id, entries[i].message_len,
+                   (unsigned long long)entries[i].last_write_ns);
+        }
+    } while (list.count == PAGE_ENTRIES);
+
+    // Close the device file
+    close(fd);
+
+    return 0;
+}
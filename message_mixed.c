@@ -0,0 +1,173 @@
+#include <fcntl.h>      // For open()
+#include <stdio.h>      // For perror(), printf() and fprintf()
+#include <stdlib.h>     // For exit(), malloc(), free(), qsort(), strtoul() and EXIT_FAILURE
+#include <string.h>     // For memset()
+#include <time.h>       // For clock_gettime()
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For read(), write() and close()
+#include "message_slot.h"
+
+// Mixed size benchmark: fills an empty slot with channels whose messages cycle through
+// inline, size class and kvmalloc()ed lengths, then rewrites and reads every channel.
+// Reports per length the median and 99th percentile write and read latency, and the
+// slot's mem_used against the bytes of message it holds.
+
+#define DEFAULT_CHANNELS 100000
+#define DEFAULT_ROUNDS 5
+
+// Lengths cycled through by channel ID: inline, just out of line, the size classes and
+// past the largest class
+static const unsigned int lengths[] = { 16, 100, 128, 129, 500, 1000, 3000, 4096, 20000 };
+#define NR_LENGTHS (sizeof(lengths) / sizeof(lengths[0]))
+#define MAX_LEN 20000
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void read_stats(int fd, struct msg_slot_stats *stats) {
+    if (ioctl(fd, MSG_SLOT_STATS, stats) != 0) {
+        fail("Error reading slot stats");
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Sorts the samples and returns the one at percentile p, in nanoseconds
+static double percentile(double *samples, unsigned long count, double p) {
+    qsort(samples, count, sizeof(*samples), compare_double);
+    return samples[(unsigned long)(p / 100 * (count - 1))] * 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    struct msg_slot_stats before;
+    struct msg_slot_stats stats;
+    unsigned int channels = DEFAULT_CHANNELS;
+    unsigned int rounds = DEFAULT_ROUNDS;
+    unsigned long per_len;
+    unsigned long n[NR_LENGTHS];
+    unsigned long long held = 0;
+    double *writes[NR_LENGTHS];
+    double *reads[NR_LENGTHS];
+    unsigned int round;
+    unsigned int id;
+    unsigned int i;
+    unsigned int len;
+    double start;
+    char *buf;
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <device file path> [channels] [rounds]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        channels = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        rounds = strtoul(argv[3], NULL, 10);
+    }
+    if (channels < NR_LENGTHS || rounds == 0) {
+        fprintf(stderr, "Need at least %zu channels and 1 round\n", NR_LENGTHS);
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    read_stats(fd, &before);
+    if (before.channel_count != 0) {
+        fprintf(stderr, "The slot must be empty\n");
+        exit(EXIT_FAILURE);
+    }
+
+    buf = malloc(MAX_LEN);
+    if (!buf) {
+        fail("Error allocating buffer");
+    }
+    memset(buf, 'x', MAX_LEN);
+    per_len = ((unsigned long)channels / NR_LENGTHS + 1) * rounds;
+    for (i = 0; i < NR_LENGTHS; i++) {
+        writes[i] = malloc(per_len * sizeof(double));
+        reads[i] = malloc(per_len * sizeof(double));
+        if (!writes[i] || !reads[i]) {
+            fail("Error allocating samples");
+        }
+        n[i] = 0;
+    }
+
+    // Fill the slot, then measure memory before the timed rounds replace the messages
+    for (id = 1; id <= channels; id++) {
+        len = lengths[id % NR_LENGTHS];
+        if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0 || write(fd, buf, len) != (ssize_t)len) {
+            fail("Error writing message");
+        }
+        held += len;
+    }
+    read_stats(fd, &stats);
+
+    for (round = 0; round < rounds; round++) {
+        for (id = 1; id <= channels; id++) {
+            i = id % NR_LENGTHS;
+            len = lengths[i];
+            if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0) {
+                fail("Error setting channel id");
+            }
+            start = now();
+            if (write(fd, buf, len) != (ssize_t)len) {
+                fail("Error writing message");
+            }
+            writes[i][n[i]] = now() - start;
+            start = now();
+            if (read(fd, buf, MAX_LEN) != (ssize_t)len) {
+                fail("Error reading message");
+            }
+            reads[i][n[i]++] = now() - start;
+        }
+    }
+
+    printf("%u channels, %llu bytes of messages, mem_used %llu bytes (%.2f per message byte)\n",
+           channels, held, (unsigned long long)(stats.mem_used - before.mem_used),
+           (double)(stats.mem_used - before.mem_used) / held);
+    printf("%-8s %-14s %-14s %-14s %-14s\n", "len", "write p50 ns", "write p99 ns", "read p50 ns",
+           "read p99 ns");
+    for (i = 0; i < NR_LENGTHS; i++) {
+        printf("%-8u %-14.0f %-14.0f %-14.0f %-14.0f\n", lengths[i], percentile(writes[i], n[i], 50),
+               percentile(writes[i], n[i], 99), percentile(reads[i], n[i], 50), percentile(reads[i], n[i], 99));
+        free(writes[i]);
+        free(reads[i]);
+    }
+
+    for (id = 1; id <= channels; id++) {
+        if (ioctl(fd, MSG_SLOT_DELETE, id) != 0) {
+            fail("Error deleting channel");
+        }
+    }
+    read_stats(fd, &stats);
+    if (stats.mem_used != before.mem_used) {
+        fprintf(stderr, "mem_used is %llu after deleting every channel, was %llu\n",
+                (unsigned long long)stats.mem_used, (unsigned long long)before.mem_used);
+        exit(EXIT_FAILURE);
+    }
+
+    free(buf);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include <fcntl.h>          // For open()
+#include <pthread.h>        // For pthread_create() and pthread_join()
+#include <sched.h>          // For sched_yield()
+#include <stdio.h>          // For perror(), printf() and fprintf()
+#include <stdlib.h>         // For exit(), malloc(), free(), qsort(), strtoul() and EXIT_FAILURE
+#include <stdint.h>         // For uint32_t, uint64_t and uintptr_t
+#include <time.h>           // For clock_gettime()
+#include <sys/eventfd.h>    // For eventfd()
+#include <sys/ioctl.h>      // For ioctl()
+#include <unistd.h>         // For read(), write() and close()
+#include "message_slot.h"
+
+// eventfd notification latency benchmark: one eventfd watches many channels, a thread
+// blocks in read() on it and a writer writes to one channel after another. The latency
+// is the time from just before the write() to the woken read() returning, one write in
+// flight at a time. Reports the median, 99th percentile and worst latency, and checks
+// the eventfd counted exactly one event per write.
+
+#define DEFAULT_CHANNELS 1000
+#define DEFAULT_WRITES 100000
+
+struct listener {
+    pthread_t thread;
+    int efd;
+    unsigned long writes;
+    double *latencies;
+    double sent;            // Set by the writer before each write
+    int acked;              // Set by the listener once it woke for the write
+    unsigned long events;
+};
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void *run_listener(void *arg) {
+    struct listener *l = arg;
+    unsigned long i;
+    uint64_t count;
+    double sent;
+
+    for (i = 0; i < l->writes; i++) {
+        if (read(l->efd, &count, sizeof(count)) != sizeof(count)) {
+            fail("Error reading eventfd");
+        }
+        __atomic_load(&l->sent, &sent, __ATOMIC_ACQUIRE);
+        l->latencies[i] = now() - sent;
+        l->events += count;
+        __atomic_store_n(&l->acked, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    struct msg_slot_eventfd watch;
+    struct listener listener;
+    unsigned int channels = DEFAULT_CHANNELS;
+    unsigned long writes = DEFAULT_WRITES;
+    unsigned int watched = 0;
+    unsigned long i;
+    uint32_t *ids;
+    double sent;
+    char msg = 'n';
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <device file path> [channels] [writes]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        channels = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        writes = strtoul(argv[3], NULL, 10);
+    }
+    if (channels == 0 || writes == 0) {
+        fprintf(stderr, "Need at least 1 channel and 1 write\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+
+    listener.efd = eventfd(0, 0);
+    if (listener.efd < 0) {
+        fail("Error creating eventfd");
+    }
+    ids = malloc(channels * sizeof(*ids));
+    listener.latencies = malloc(writes * sizeof(double));
+    if (!ids || !listener.latencies) {
+        fail("Error allocating buffers");
+    }
+
+    // Watch every channel with the one eventfd, MSG_SLOT_WATCH_MAX at a time
+    for (i = 0; i < channels; i++) {
+        ids[i] = i + 1;
+    }
+    while (watched < channels) {
+        watch.fd = listener.efd;
+        watch.count = channels - watched < MSG_SLOT_WATCH_MAX ? channels - watched : MSG_SLOT_WATCH_MAX;
+        watch.channel_ids = (uintptr_t)(ids + watched);
+        if (ioctl(fd, MSG_SLOT_WATCH_EVENTFD, &watch) != 0) {
+            fail("Error watching channels");
+        }
+        watched += watch.count;
+    }
+
+    listener.writes = writes;
+    listener.events = 0;
+    listener.acked = 0;
+    if (pthread_create(&listener.thread, NULL, run_listener, &listener) != 0) {
+        fprintf(stderr, "Error creating thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < writes; i++) {
+        if (ioctl(fd, MSG_SLOT_CHANNEL, ids[i % channels]) != 0) {
+            fail("Error setting channel id");
+        }
+        sent = now();
+        __atomic_store(&listener.sent, &sent, __ATOMIC_RELEASE);
+        if (write(fd, &msg, 1) != 1) {
+            fail("Error writing message");
+        }
+        while (!__atomic_load_n(&listener.acked, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+        __atomic_store_n(&listener.acked, 0, __ATOMIC_RELAXED);
+    }
+    pthread_join(listener.thread, NULL);
+
+    for (i = 0; i < channels && i < writes; i++) {
+        if (ioctl(fd, MSG_SLOT_DELETE, ids[i]) != 0) {
+            fail("Error deleting channel");
+        }
+    }
+
+    qsort(listener.latencies, writes, sizeof(double), compare_double);
+    printf("%lu writes across %u watched channels\n", writes, channels);
+    printf("Latency: p50 %.1f us, p99 %.1f us, max %.1f us\n", listener.latencies[writes / 2] * 1e6,
+           listener.latencies[(writes - 1) * 99 / 100] * 1e6, listener.latencies[writes - 1] * 1e6);
+
+    if (listener.events != writes) {
+        fprintf(stderr, "The eventfd counted %lu events for %lu writes\n", listener.events, writes);
+        exit(EXIT_FAILURE);
+    }
+
+    free(listener.latencies);
+    free(ids);
+    close(listener.efd);
+    close(fd);
+
+    return 0;
+}
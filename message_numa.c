@@ -0,0 +1,191 @@
+#define _GNU_SOURCE     // For sched_setaffinity() and the CPU_* macros
+#include <fcntl.h>      // For open()
+#include <sched.h>      // For sched_setaffinity(), CPU_ZERO() and CPU_SET()
+#include <stdio.h>      // For perror(), printf(), fprintf(), snprintf(), fopen() and fscanf()
+#include <stdlib.h>     // For exit(), malloc(), free(), strtoul() and EXIT_FAILURE
+#include <string.h>     // For memset()
+#include <time.h>       // For clock_gettime()
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For read(), write() and close()
+#include "message_slot.h"
+
+// NUMA placement benchmark for two-node hosts: places an empty slot's memory on one node
+// with MSG_SLOT_SET_NUMA_NODE, fills it, and times writing and reading every channel
+// from a thread pinned to a CPU of the same node and of the other node. Prints the cost
+// per operation for each pairing, so the penalty of remote memory is the difference
+// between the rows of one column. The slot's placement is restored afterwards.
+
+#define DEFAULT_CHANNELS 10000
+#define DEFAULT_LEN 1000
+#define DEFAULT_PASSES 50
+#define NODES 2
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the first CPU of a node from sysfs, or -1 if the node does not exist
+static int node_cpu(int node) {
+    char path[64];
+    FILE *f;
+    int cpu;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    if (fscanf(f, "%d", &cpu) != 1) {
+        cpu = -1; // A node without CPUs
+    }
+    fclose(f);
+    return cpu;
+}
+
+static void pin_to(int cpu) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        fail("Error pinning to CPU");
+    }
+}
+
+// Writes every channel passes times, returns nanoseconds per write
+static double time_writes(int fd, const char *buf, size_t len, unsigned int channels, unsigned int passes) {
+    unsigned int pass;
+    unsigned int id;
+    double start = now();
+
+    for (pass = 0; pass < passes; pass++) {
+        for (id = 1; id <= channels; id++) {
+            if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0 || write(fd, buf, len) != (ssize_t)len) {
+                fail("Error writing message");
+            }
+        }
+    }
+    return (now() - start) * 1e9 / ((double)channels * passes);
+}
+
+// Reads every channel passes times, returns nanoseconds per read
+static double time_reads(int fd, char *buf, size_t len, unsigned int channels, unsigned int passes) {
+    unsigned int pass;
+    unsigned int id;
+    double start = now();
+
+    for (pass = 0; pass < passes; pass++) {
+        for (id = 1; id <= channels; id++) {
+            if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0 || read(fd, buf, len) != (ssize_t)len) {
+                fail("Error reading message");
+            }
+        }
+    }
+    return (now() - start) * 1e9 / ((double)channels * passes);
+}
+
+int main(int argc, char *argv[]) {
+    struct msg_slot_stats stats;
+    unsigned int channels = DEFAULT_CHANNELS;
+    unsigned int passes = DEFAULT_PASSES;
+    size_t len = DEFAULT_LEN;
+    double write_ns[NODES][NODES];  // [memory node][CPU node]
+    double read_ns[NODES][NODES];
+    int cpus[NODES];
+    unsigned int id;
+    int mem;
+    int cpu;
+    char *buf;
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 5) {
+        fprintf(stderr, "Usage: %s <device file path> [channels] [message len] [passes]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        channels = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        len = strtoul(argv[3], NULL, 10);
+    }
+    if (argc > 4) {
+        passes = strtoul(argv[4], NULL, 10);
+    }
+    if (channels == 0 || len == 0 || passes == 0) {
+        fprintf(stderr, "Need at least 1 channel, a message of 1 byte and 1 pass\n");
+        exit(EXIT_FAILURE);
+    }
+    for (mem = 0; mem < NODES; mem++) {
+        cpus[mem] = node_cpu(mem);
+        if (cpus[mem] < 0) {
+            fprintf(stderr, "Node %d has no CPUs, this benchmark needs %d nodes with CPUs\n", mem, NODES);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    if (ioctl(fd, MSG_SLOT_STATS, &stats) != 0) {
+        fail("Error reading slot stats");
+    }
+    if (stats.channel_count != 0) {
+        fprintf(stderr, "The slot must be empty\n");
+        exit(EXIT_FAILURE);
+    }
+
+    buf = malloc(len);
+    if (!buf) {
+        fail("Error allocating buffer");
+    }
+    memset(buf, 'n', len);
+
+    for (mem = 0; mem < NODES; mem++) {
+        if (ioctl(fd, MSG_SLOT_SET_NUMA_NODE, mem) != 0) {
+            fail("Error placing the slot");
+        }
+        // The channels are created on the slot's node whichever CPU creates them
+        time_writes(fd, buf, len, channels, 1);
+
+        for (cpu = 0; cpu < NODES; cpu++) {
+            pin_to(cpus[cpu]);
+            write_ns[mem][cpu] = time_writes(fd, buf, len, channels, passes);
+            read_ns[mem][cpu] = time_reads(fd, buf, len, channels, passes);
+        }
+
+        for (id = 1; id <= channels; id++) {
+            if (ioctl(fd, MSG_SLOT_DELETE, id) != 0) {
+                fail("Error deleting channel");
+            }
+        }
+    }
+
+    if (ioctl(fd, MSG_SLOT_SET_NUMA_NODE, stats.numa_node) != 0) {
+        fail("Error restoring the slot's placement");
+    }
+
+    printf("%u channels of %zu bytes, %u passes\n", channels, len, passes);
+    printf("%-12s %-10s %-14s %-14s\n", "memory node", "CPU node", "write ns", "read ns");
+    for (mem = 0; mem < NODES; mem++) {
+        for (cpu = 0; cpu < NODES; cpu++) {
+            printf("%-12d %-10d %-14.0f %-14.0f%s\n", mem, cpu, write_ns[mem][cpu], read_ns[mem][cpu],
+                   mem == cpu ? "" : "  (remote)");
+        }
+    }
+
+    free(buf);
+    close(fd);
+
+    return 0;
+}
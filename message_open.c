@@ -0,0 +1,156 @@
+#define _GNU_SOURCE         // For sched_setaffinity() and the CPU_* macros
+#include <fcntl.h>          // For open()
+#include <sched.h>          // For sched_setaffinity(), sched_yield(), CPU_ZERO() and CPU_SET()
+#include <stdio.h>          // For perror(), printf() and fprintf()
+#include <stdlib.h>         // For exit(), strtoul() and EXIT_FAILURE
+#include <time.h>           // For clock_gettime()
+#include <sys/mman.h>       // For mmap() and munmap()
+#include <sys/wait.h>       // For waitpid()
+#include <unistd.h>         // For fork(), close(), sleep(), sysconf() and _exit()
+
+// Multi-process open() scaling benchmark: for 1, 2, 4, ... up to the number of online
+// CPUs, forks that many processes, each pinned to its own CPU, which open and close the
+// device file in a loop for a fixed time, the way fork-per-request workers do. Prints
+// the opens per second of each run and how close it comes to linear scaling from the
+// single process run.
+
+#define DEFAULT_SECONDS 2
+#define MAX_PROCS 1024
+
+// Shared with the children through an anonymous shared mapping
+struct shared {
+    int start;
+    int stop;
+    unsigned long opens[MAX_PROCS];
+};
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_child(struct shared *sh, const char *path, unsigned int index) {
+    unsigned long opens = 0;
+    cpu_set_t set;
+    int fd;
+
+    CPU_ZERO(&set);
+    CPU_SET(index, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("Error pinning to CPU");
+        _exit(EXIT_FAILURE);
+    }
+
+    while (!__atomic_load_n(&sh->start, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    while (!__atomic_load_n(&sh->stop, __ATOMIC_ACQUIRE)) {
+        fd = open(path, O_RDWR);
+        if (fd < 0) {
+            perror("Error opening device file");
+            _exit(EXIT_FAILURE);
+        }
+        close(fd);
+        opens++;
+    }
+    sh->opens[index] = opens;
+    _exit(0);
+}
+
+// Runs procs processes for the given time, returns opens per second
+static double run(struct shared *sh, const char *path, unsigned int procs, unsigned int seconds) {
+    unsigned long opens = 0;
+    unsigned int i;
+    double start;
+    int status;
+    int failed = 0;
+    pid_t pid;
+
+    sh->start = 0;
+    sh->stop = 0;
+    for (i = 0; i < procs; i++) {
+        sh->opens[i] = 0;
+        pid = fork();
+        if (pid < 0) {
+            fail("Error forking");
+        }
+        if (pid == 0) {
+            run_child(sh, path, i);
+        }
+    }
+
+    start = now();
+    __atomic_store_n(&sh->start, 1, __ATOMIC_RELEASE);
+    sleep(seconds);
+    __atomic_store_n(&sh->stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < procs; i++) {
+        if (waitpid(-1, &status, 0) < 0) {
+            fail("Error waiting for a child");
+        }
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    if (failed) {
+        fprintf(stderr, "A child process failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < procs; i++) {
+        opens += sh->opens[i];
+    }
+    return opens / (now() - start);
+}
+
+int main(int argc, char *argv[]) {
+    struct shared *sh;
+    unsigned int seconds = DEFAULT_SECONDS;
+    unsigned int cpus;
+    unsigned int procs;
+    double single = 0;
+    double rate;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <device file path> [seconds per run]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        seconds = strtoul(argv[2], NULL, 10);
+    }
+    if (seconds == 0) {
+        fprintf(stderr, "Need runs of at least 1 second\n");
+        exit(EXIT_FAILURE);
+    }
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > MAX_PROCS) {
+        cpus = MAX_PROCS;
+    }
+
+    sh = mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sh == MAP_FAILED) {
+        fail("Error mapping shared memory");
+    }
+
+    // 1, 2, 4, ... processes, ending with every CPU
+    printf("%-10s %-14s %-14s %-10s\n", "processes", "opens/s", "per process", "linear");
+    for (procs = 1;; procs = procs * 2 < cpus ? procs * 2 : cpus) {
+        rate = run(sh, argv[1], procs, seconds);
+        if (procs == 1) {
+            single = rate;
+        }
+        printf("%-10u %-14.0f %-14.0f %.0f%%\n", procs, rate, rate / procs, 100 * rate / (single * procs));
+        if (procs == cpus) {
+            break;
+        }
+    }
+
+    munmap(sh, sizeof(*sh));
+
+    return 0;
+}
@@ -5,10 +5,13 @@
 #include <sys/ioctl.h>  // For ioctl()
 #include <unistd.h>     // For read(), write(), and close()
 #include "message_slot.h"
+
+#define CHUNK_SIZE 4096  // Bytes read at a time, messages can be far longer
+
 int main(int argc, char *argv[]) {
     int fd, ret;
     unsigned long channel_id;
-    char buffer[128];  // Assuming max message size is 128 as per kernel module
+    char buffer[CHUNK_SIZE];
 
     // Validate the correct number of command-line arguments
     if (argc != 3) {
@@ -33,8 +36,21 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    // Read a message from the message slot file to a buffer
-    ret = read(fd, buffer, sizeof(buffer));
+    // Read the message in chunks, the kernel tracks how far we got
+    if (ioctl(fd, MSG_SLOT_SET_READ_MODE, MSG_SLOT_READ_STREAM) != 0) {
+        perror("Error setting read mode");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+
+    // Copy the message to standard output until the read that ends it returns 0
+    while ((ret = read(fd, buffer, sizeof(buffer))) > 0) {
+        if (write(STDOUT_FILENO, buffer, ret) < 0) {
+            perror("Error writing message to stdout");
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+    }
     if (ret < 0) {
         perror("Error reading message");
         close(fd);
@@ -44,12 +60,6 @@ int main(int argc, char *argv[]) {
     // Close the device file
     close(fd);
 
-    // Print the message to standard output
-    if (write(STDOUT_FILENO, buffer, ret) < 0) {
-        perror("Error writing message to stdout");
-        exit(EXIT_FAILURE);
-    }
-
     // Exit the program with success
     return 0;
 }
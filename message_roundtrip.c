@@ -0,0 +1,226 @@
+#include <fcntl.h>      // For open()
+#include <errno.h>      // For errno
+#include <stdio.h>      // For perror(), printf() and fprintf()
+#include <stdlib.h>     // For exit(), malloc(), realloc(), strtoul() and EXIT_FAILURE
+#include <string.h>     // For memset() and memcmp()
+#include <stdint.h>     // For uintptr_t
+#include <time.h>       // For clock_gettime()
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For read(), write() and close()
+#include "message_slot.h"
+
+// Round trip test of MSG_SLOT_EXPORT and MSG_SLOT_IMPORT: fills an empty slot with
+// channels of many message lengths, exports it, deletes every channel, imports the
+// stream back and checks every message byte for byte. Reports the export and import
+// throughput. With a compression threshold the compressed export path is covered too.
+
+#define DEFAULT_CHANNELS 100000
+#define CHUNK_SIZE (4 << 20)     // Bytes per MSG_SLOT_EXPORT/IMPORT call
+#define LARGE_LEN 300000         // Past the kernel's export chunk, copied out on its own
+
+// Lengths cycled through by channel ID: shortest, inline, just out of line, size
+// classes and kvmalloc()ed. Every 1024th channel gets LARGE_LEN instead.
+static const unsigned int lengths[] = { 1, 100, 128, 129, 512, 2000, 4096, 70000 };
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int message_len(unsigned int id) {
+    return id % 1024 == 0 ? LARGE_LEN : lengths[id % (sizeof(lengths) / sizeof(lengths[0]))];
+}
+
+// The message of a channel, repetitive enough to compress but different per channel
+static void fill_message(unsigned int id, char *buf, unsigned int len) {
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = (char)(id * 31 + i / 16);
+    }
+}
+
+static unsigned long long channel_count(int fd) {
+    struct msg_slot_stats stats;
+
+    if (ioctl(fd, MSG_SLOT_STATS, &stats) != 0) {
+        fail("Error reading slot stats");
+    }
+    return stats.channel_count;
+}
+
+// Exports the whole slot into a growing buffer, returns its length
+static size_t export_slot(int fd, char **stream, unsigned long long *records) {
+    struct msg_slot_snapshot snap;
+    size_t used = 0;
+
+    memset(&snap, 0, sizeof(snap));
+    *records = 0;
+    do {
+        *stream = realloc(*stream, used + CHUNK_SIZE);
+        if (!*stream) {
+            fail("Error allocating stream");
+        }
+        snap.buf = (uintptr_t)(*stream + used);
+        snap.len = CHUNK_SIZE;
+        if (ioctl(fd, MSG_SLOT_EXPORT, &snap) != 0) {
+            fail("Error exporting slot");
+        }
+        used += snap.len;
+        *records += snap.count;
+    } while (!(snap.flags & MSG_SLOT_SNAPSHOT_END));
+
+    return used;
+}
+
+// Imports the stream chunk by chunk, a record cut off by a chunk is passed again
+static unsigned long long import_slot(int fd, char *stream, size_t len) {
+    struct msg_slot_snapshot snap;
+    unsigned long long records = 0;
+    size_t pos = 0;
+
+    memset(&snap, 0, sizeof(snap));
+    while (pos < len) {
+        snap.buf = (uintptr_t)(stream + pos);
+        snap.len = len - pos < CHUNK_SIZE ? len - pos : CHUNK_SIZE;
+        if (ioctl(fd, MSG_SLOT_IMPORT, &snap) != 0) {
+            fail("Error importing slot");
+        }
+        if (snap.len == 0) {
+            fprintf(stderr, "Import made no progress at offset %zu\n", pos);
+            exit(EXIT_FAILURE);
+        }
+        pos += snap.len;
+        records += snap.count;
+    }
+    return records;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int channels = DEFAULT_CHANNELS;
+    unsigned int threshold = 0;
+    unsigned long long exported;
+    unsigned long long imported;
+    unsigned long bad = 0;
+    unsigned int id;
+    unsigned int len;
+    char *expected;
+    char *actual;
+    char *stream = NULL;
+    size_t stream_len;
+    double start;
+    double export_s;
+    double import_s;
+    ssize_t n;
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <device file path> [channels] [compress threshold]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        channels = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        threshold = strtoul(argv[3], NULL, 10);
+    }
+    if (channels == 0) {
+        fprintf(stderr, "Need at least 1 channel\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    if (channel_count(fd) != 0) {
+        fprintf(stderr, "The slot must be empty\n");
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 3 && ioctl(fd, MSG_SLOT_SET_COMPRESSION, threshold) != 0) {
+        fail("Error setting compression threshold");
+    }
+
+    expected = malloc(LARGE_LEN);
+    actual = malloc(LARGE_LEN);
+    if (!expected || !actual) {
+        fail("Error allocating buffers");
+    }
+
+    // Fill the slot
+    for (id = 1; id <= channels; id++) {
+        len = message_len(id);
+        fill_message(id, expected, len);
+        if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0 || write(fd, expected, len) != (ssize_t)len) {
+            fail("Error writing message");
+        }
+    }
+
+    start = now();
+    stream_len = export_slot(fd, &stream, &exported);
+    export_s = now() - start;
+    if (exported != channels) {
+        fprintf(stderr, "Exported %llu of %u channels\n", exported, channels);
+        exit(EXIT_FAILURE);
+    }
+
+    // Empty the slot and load the stream back
+    for (id = 1; id <= channels; id++) {
+        if (ioctl(fd, MSG_SLOT_DELETE, id) != 0) {
+            fail("Error deleting channel");
+        }
+    }
+    if (channel_count(fd) != 0) {
+        fprintf(stderr, "Slot not empty after deleting every channel\n");
+        exit(EXIT_FAILURE);
+    }
+
+    start = now();
+    imported = import_slot(fd, stream, stream_len);
+    import_s = now() - start;
+    if (imported != channels || channel_count(fd) != channels) {
+        fprintf(stderr, "Imported %llu records into %llu channels, expected %u\n", imported,
+                channel_count(fd), channels);
+        exit(EXIT_FAILURE);
+    }
+
+    // Every message must come back byte for byte
+    for (id = 1; id <= channels; id++) {
+        len = message_len(id);
+        fill_message(id, expected, len);
+        if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0) {
+            fail("Error setting channel id");
+        }
+        n = read(fd, actual, LARGE_LEN);
+        if (n < 0 && errno != EWOULDBLOCK) {
+            fail("Error reading message");
+        }
+        if (n != (ssize_t)len || memcmp(actual, expected, len) != 0) {
+            fprintf(stderr, "Channel %u does not hold its message\n", id);
+            bad++;
+        }
+    }
+    if (bad) {
+        fprintf(stderr, "%lu channels differ after the round trip\n", bad);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%u channels, %zu byte stream: export %.0f MB/s, import %.0f MB/s\n", channels,
+           stream_len, stream_len / export_s / 1e6, stream_len / import_s / 1e6);
+
+    free(stream);
+    free(actual);
+    free(expected);
+    close(fd);
+
+    return 0;
+}
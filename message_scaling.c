@@ -0,0 +1,149 @@
+#include <fcntl.h>      // For open()
+#include <pthread.h>    // For pthread_create() and pthread_join()
+#include <stdio.h>      // For perror(), printf() and fprintf()
+#include <stdlib.h>     // For exit(), calloc(), free() and EXIT_FAILURE
+#include <time.h>       // For clock_gettime()
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For read(), write(), close(), usleep() and sysconf()
+#include "message_slot.h"
+
+// Scaling benchmark across minors and cores: for 1, 2, 4, ... up to the number of online
+// CPUs threads, every thread writes and reads its own channel for a fixed time, with all
+// threads on the first device file and then spread round-robin over every device file
+// given, each a different minor and so a different slot. Prints the operations per
+// second of each run. Throughput should grow with the threads in both columns, as
+// neither the slots nor channels of different stripes share a lock.
+
+#define RUN_USEC 1000000    // Length of one run
+#define MSG_LEN 64
+#define FIRST_ID 1000       // Thread t uses channel FIRST_ID + t
+
+struct worker {
+    pthread_t thread;
+    const char *path;
+    unsigned int channel_id;
+    unsigned long ops;
+    int *stop;
+};
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *run_worker(void *arg) {
+    struct worker *w = arg;
+    char msg[MSG_LEN] = "scaling";
+    int fd;
+
+    fd = open(w->path, O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    if (ioctl(fd, MSG_SLOT_CHANNEL, w->channel_id) != 0) {
+        fail("Error setting channel id");
+    }
+
+    while (!__atomic_load_n(w->stop, __ATOMIC_ACQUIRE)) {
+        if (write(fd, msg, sizeof(msg)) != sizeof(msg) || read(fd, msg, sizeof(msg)) != sizeof(msg)) {
+            fail("Error writing or reading message");
+        }
+        w->ops += 2;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+// Runs threads workers over the first minors device files, returns operations per second
+static double run(char **paths, unsigned int minors, unsigned int threads, struct worker *workers) {
+    unsigned long ops = 0;
+    unsigned int t;
+    double start;
+    int stop = 0;
+
+    start = now();
+    for (t = 0; t < threads; t++) {
+        workers[t].path = paths[t % minors];
+        workers[t].channel_id = FIRST_ID + t;
+        workers[t].ops = 0;
+        workers[t].stop = &stop;
+        if (pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]) != 0) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    usleep(RUN_USEC);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    for (t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        ops += workers[t].ops;
+    }
+    return ops / (now() - start);
+}
+
+// Deletes the channels the threads created in every slot
+static void clean_up(char **paths, unsigned int minors, unsigned int threads) {
+    unsigned int m;
+    unsigned int t;
+    int fd;
+
+    for (m = 0; m < minors; m++) {
+        fd = open(paths[m], O_RDWR);
+        if (fd < 0) {
+            fail("Error opening device file");
+        }
+        for (t = m; t < threads; t += minors) {
+            if (ioctl(fd, MSG_SLOT_DELETE, FIRST_ID + t) != 0) {
+                fail("Error deleting channel");
+            }
+        }
+        close(fd);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct worker *workers;
+    unsigned int minors;
+    unsigned int cpus;
+    unsigned int threads;
+    double one;
+    double spread;
+
+    // Validate the command-line arguments
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <device file path> [device file paths of other minors...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    minors = argc - 1;
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    workers = calloc(cpus, sizeof(*workers));
+    if (!workers) {
+        fail("Error allocating threads");
+    }
+
+    // 1, 2, 4, ... threads, ending with every CPU
+    printf("%-10s %-18s %u minors ops/s\n", "threads", "1 minor ops/s", minors);
+    for (threads = 1;; threads = threads * 2 < cpus ? threads * 2 : cpus) {
+        one = run(argv + 1, 1, threads, workers);
+        clean_up(argv + 1, 1, threads);
+        spread = run(argv + 1, minors, threads, workers);
+        clean_up(argv + 1, minors, threads);
+        printf("%-10u %-18.0f %-18.0f\n", threads, one, spread);
+        if (threads == cpus) {
+            break;
+        }
+    }
+
+    free(workers);
+
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include <fcntl.h>      // For open()
+#include <errno.h>      // For errno and EWOULDBLOCK
+#include <pthread.h>    // For pthread_create() and pthread_join()
+#include <stdio.h>      // For perror(), printf() and fprintf()
+#include <stdlib.h>     // For exit(), calloc(), free(), strtoul() and EXIT_FAILURE
+#include <time.h>       // For clock_gettime()
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For read(), usleep() and close()
+#include "message_slot.h"
+
+// Reader scan benchmark: threads select every channel ID of a large range on an empty
+// slot and read it, the way a client probing for messages does. Since selecting or
+// reading a channel never creates it, every read must fail with EWOULDBLOCK and the
+// slot's mem_used and channel_count, sampled while the scan runs, must stay where they
+// started. Reports the probes per second.
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_IDS (1U << 20)
+#define SAMPLE_USEC 200000      // Time between two samples of the slot
+
+struct scanner {
+    pthread_t thread;
+    const char *path;
+    unsigned int first_id;
+    unsigned int last_id;
+    unsigned long unexpected;   // Reads that did not fail with EWOULDBLOCK
+    int done;
+};
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void read_stats(int fd, struct msg_slot_stats *stats) {
+    if (ioctl(fd, MSG_SLOT_STATS, stats) != 0) {
+        fail("Error reading slot stats");
+    }
+}
+
+static void *run_scanner(void *arg) {
+    struct scanner *s = arg;
+    unsigned int id;
+    char buf[256];
+    int fd;
+
+    fd = open(s->path, O_RDONLY);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+
+    for (id = s->first_id; id <= s->last_id; id++) {
+        if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0) {
+            fail("Error setting channel id");
+        }
+        if (read(fd, buf, sizeof(buf)) != -1 || errno != EWOULDBLOCK) {
+            s->unexpected++;
+        }
+    }
+
+    close(fd);
+    __atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Returns whether every thread has finished its range
+static int all_done(struct scanner *scanners, unsigned int threads) {
+    unsigned int t;
+
+    for (t = 0; t < threads; t++) {
+        if (!__atomic_load_n(&scanners[t].done, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    struct msg_slot_stats before;
+    struct msg_slot_stats stats;
+    struct scanner *scanners;
+    unsigned int threads = DEFAULT_THREADS;
+    unsigned int ids = DEFAULT_IDS;
+    unsigned long unexpected = 0;
+    unsigned long changed = 0;
+    unsigned int per_thread;
+    unsigned int t;
+    double start;
+    double elapsed;
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <device file path> [threads] [ids]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        threads = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        ids = strtoul(argv[3], NULL, 10);
+    }
+    if (threads == 0 || ids < threads) {
+        fprintf(stderr, "Need at least 1 thread and 1 ID per thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    read_stats(fd, &before);
+    if (before.channel_count != 0) {
+        fprintf(stderr, "The slot must be empty\n");
+        exit(EXIT_FAILURE);
+    }
+
+    scanners = calloc(threads, sizeof(*scanners));
+    if (!scanners) {
+        fail("Error allocating threads");
+    }
+
+    per_thread = ids / threads;
+    start = now();
+    for (t = 0; t < threads; t++) {
+        scanners[t].path = argv[1];
+        scanners[t].first_id = 1 + t * per_thread;
+        scanners[t].last_id = t == threads - 1 ? ids : (t + 1) * per_thread;
+        if (pthread_create(&scanners[t].thread, NULL, run_scanner, &scanners[t]) != 0) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Sample the slot while the threads scan, neither value may move
+    printf("%-10s %-14s %-14s\n", "seconds", "channel_count", "mem_used");
+    while (!all_done(scanners, threads)) {
+        usleep(SAMPLE_USEC);
+        read_stats(fd, &stats);
+        if (stats.channel_count != before.channel_count || stats.mem_used != before.mem_used) {
+            changed++;
+        }
+        printf("%-10.2f %-14llu %-14llu\n", now() - start, (unsigned long long)stats.channel_count,
+               (unsigned long long)stats.mem_used);
+    }
+
+    for (t = 0; t < threads; t++) {
+        pthread_join(scanners[t].thread, NULL);
+        unexpected += scanners[t].unexpected;
+    }
+    elapsed = now() - start;
+    read_stats(fd, &stats);
+
+    printf("%u IDs scanned by %u threads in %.2f s, %.0f probes/s\n", ids, threads, elapsed, ids / elapsed);
+
+    if (unexpected) {
+        fprintf(stderr, "%lu reads of unwritten channels did not fail with EWOULDBLOCK\n", unexpected);
+        exit(EXIT_FAILURE);
+    }
+    if (changed || stats.channel_count != before.channel_count || stats.mem_used != before.mem_used) {
+        fprintf(stderr, "The scan changed the slot: %llu channels, %llu bytes\n",
+                (unsigned long long)stats.channel_count, (unsigned long long)stats.mem_used);
+        exit(EXIT_FAILURE);
+    }
+
+    free(scanners);
+    close(fd);
+
+    return 0;
+}
@@ -3,9 +3,38 @@
 #include <linux/fs.h>           // Character device drivers
 #include <linux/init.h>         // Macros used to mark up functions e.g. __init __exit
 #include <linux/cdev.h>         // Char device structure
+#include <linux/device.h>       // Device class, udev creates the nodes
+#include <linux/kdev_t.h>       // MAJOR() and MKDEV()
+#include <linux/sysfs.h>        // sysfs_emit()
 #include <linux/slab.h>         // kmalloc() and kfree()
+#include <linux/mm.h>           // kvcalloc() and kvfree()
 #include <linux/uaccess.h>      // Copy to/from user
 #include <linux/errno.h>
+#include <linux/xarray.h>       // Per slot channel index
+#include <linux/ktime.h>        // Last write timestamps
+#include <linux/jiffies.h>      // Last access timestamps
+#include <linux/workqueue.h>    // Idle channel eviction
+#include <linux/moduleparam.h>  // Module parameters
+#include <linux/spinlock.h>     // Per slot striped locks
+#include <linux/mutex.h>        // Transaction writers
+#include <linux/seqlock.h>      // Transaction generation
+#include <linux/hash.h>         // Channel ID to lock stripe
+#include <linux/numa.h>         // NUMA_NO_NODE
+#include <linux/nodemask.h>     // node_online()
+#include <linux/topology.h>     // numa_node_id()
+#include <linux/overflow.h>     // struct_size()
+#include <linux/uio.h>          // iov_iter, read/write and splice share it
+#include <linux/splice.h>       // SPLICE_F_MORE
+#include <linux/pipe_fs_i.h>    // Pipe capacity of a splice write
+#include <linux/eventfd.h>      // Channel update notifications
+#include <linux/rculist.h>      // Watch lists walked by writers
+#include <linux/anon_inodes.h>  // Notification fds
+#include <linux/file.h>         // fget() and fput()
+#include <linux/poll.h>         // Polling notification fds
+#include <linux/sched/signal.h> // Interruptible notification reads
+#include <linux/percpu.h>       // Error counters
+#include <linux/lz4.h>          // Message compression
+#include <linux/capability.h>   // Privileged limit changes
 #include "message_slot.h"       // Definitions for our device
 
 
@@ -16,146 +45,642 @@ MODULE_DESCRIPTION("Message Slot Device Driver");
 MODULE_DESCRIPTION("A simple example Linux module.");
 MODULE_VERSION("0.1");
 
+// Default byte budget of every new slot, can be changed per slot with MSG_SLOT_SET_QUOTA
+static unsigned long slot_mem_quota = 0;
+module_param(slot_mem_quota, ulong, 0644);
+MODULE_PARM_DESC(slot_mem_quota, "Default per-slot memory quota in bytes (0 = unlimited)");
+
+// Default NUMA placement of every new slot, can be changed per slot with MSG_SLOT_SET_NUMA_NODE
+static int slot_numa_node = MSG_SLOT_NUMA_LOCAL;
+module_param(slot_numa_node, int, 0644);
+MODULE_PARM_DESC(slot_numa_node, "Default NUMA node of new slots (-1 = local to the allocating CPU, -2 = first writer's node)");
+
+// Default channel limits of every new slot, can be changed per slot with MSG_SLOT_SET_CHANNEL_LIMITS
+static unsigned long slot_channel_soft_limit = 0;
+module_param(slot_channel_soft_limit, ulong, 0644);
+MODULE_PARM_DESC(slot_channel_soft_limit, "Default per-slot channel count past which creations are logged (0 = none)");
+
+static unsigned long slot_channel_hard_limit = 1UL << 20;
+module_param(slot_channel_hard_limit, ulong, 0644);
+MODULE_PARM_DESC(slot_channel_hard_limit, "Default per-slot channel limit (default 2^20, 0 = unlimited)");
+
+// Default compression threshold of every new slot, can be changed per slot with MSG_SLOT_SET_COMPRESSION
+static unsigned int slot_compress_threshold = 0;
+module_param(slot_compress_threshold, uint, 0644);
+MODULE_PARM_DESC(slot_compress_threshold, "Default length in bytes past which messages are LZ4 compressed (0 = off)");
+
+// Longest message accepted, messages past the largest payload cache are kvmalloc'ed
+static unsigned int max_message_len = 4 << 20;
+module_param(max_message_len, uint, 0644);
+MODULE_PARM_DESC(max_message_len, "Longest message in bytes (default 4 MiB, at most 16 MiB)");
+
+// Number of minors, and so of slots, registered at load time
+static unsigned int nr_minors = 256;
+module_param(nr_minors, uint, 0444);
+MODULE_PARM_DESC(nr_minors, "Number of message slot minors to register (default 256)");
+
 // Function prototypes
 static int __init message_slot_init(void);
 static void __exit message_slot_exit(void);
 // Function prototypes for file operations
 static int device_open(struct inode *, struct file *);
+static void free_slot(struct message_slot *slot);
+static int device_release(struct inode *, struct file *);
 static long device_ioctl(struct file *, unsigned int, unsigned long);
 // Helper function for device_ioctl
 static struct message_channel* get_or_create_channel(struct message_slot* slot, unsigned int channel_id);
-static ssize_t device_read(struct file *, char __user *, size_t, loff_t *);
-static ssize_t device_write(struct file *, const char __user *, size_t, loff_t *);
+static struct message_channel *find_channel(struct message_slot *slot, unsigned int channel_id);
+static spinlock_t *channel_lock(struct message_slot *slot, unsigned int channel_id);
+static void put_channel(struct message_channel *channel);
+static void free_channel(struct message_channel *channel);
+static long delete_channel(struct message_slot *slot, unsigned int channel_id);
+static void touch_channel(struct message_channel *channel);
+static long set_ttl(struct message_slot *slot, unsigned long seconds);
+static void evict_idle_channels(struct work_struct *work);
+static long get_stats(struct message_slot *slot, struct msg_slot_stats __user *uarg);
+static long set_channel_limits(struct message_slot *slot, struct msg_slot_limits __user *uarg);
+static int charge_slot(struct message_slot *slot, size_t bytes);
+static void uncharge_slot(struct message_slot *slot, size_t bytes);
+static int slot_node(struct message_slot *slot);
+static bool valid_numa_node(int node);
+static long set_numa_node(struct message_slot *slot, int node);
+static long list_channels(struct message_slot *slot, struct msg_slot_list __user *uarg);
+static long set_broadcast(struct message_slot *slot, struct msg_slot_broadcast __user *uarg);
+static long set_compression(struct message_slot *slot, unsigned long threshold);
+static bool message_len_ok(size_t len);
+static struct message_payload *alloc_payload(struct message_slot *slot, const char *data, size_t len);
+static void put_payload(struct message_slot *slot, struct message_payload *payload);
+static void copy_message(struct message_channel *channel, struct message_copy *copy);
+static int unpack_copy(struct message_slot *slot, struct message_copy *copy);
+static void release_copy(struct message_slot *slot, struct message_copy *copy);
+static void free_unpacked(struct message_slot *slot, struct message_unpacked *unpacked);
+static int unpack_cached(struct message_file *mfile, struct message_copy *copy);
+static void release_cached(struct message_file *mfile, struct message_copy *copy, bool done);
+static struct message_payload *compress_payload(struct message_slot *slot, const char *data, size_t len);
+static struct message_payload *pack_message(struct message_slot *slot, const char *data, size_t len,
+                                            struct message_payload *payload);
+static const char *copy_message_in(struct message_slot *slot, struct iov_iter *from, char *kbuf,
+                                   struct message_payload **payload);
+static void free_log(struct message_slot *slot, struct message_log *log);
+static ssize_t read_stream(const char *data, size_t len, struct kiocb *iocb, struct iov_iter *to);
+static ssize_t read_broadcast(struct message_file *mfile, struct message_channel *channel,
+                              struct kiocb *iocb, struct iov_iter *to);
+static u64 next_seq(struct message_channel *channel);
+static int prepare_update(struct message_slot *slot, unsigned int channel_id, const char *data,
+                          size_t len, struct message_payload *payload, bool create,
+                          struct message_update *update);
+static int commit_update(struct message_slot *slot, struct message_update *update,
+                         const u64 *expected, u64 *seq);
+static int add_log_payload(struct message_slot *slot, struct message_update *update);
+static void finish_update(struct message_slot *slot, struct message_update *update);
+static int store_message(struct message_slot *slot, unsigned int channel_id, const char *kbuf,
+                         size_t count, struct message_payload *payload, const u64 *expected, u64 *seq);
+static long compare_and_swap(struct message_file *mfile, struct msg_slot_cas __user *uarg);
+static long txn_write(struct message_slot *slot, struct msg_slot_txn __user *uarg);
+static long txn_read(struct message_slot *slot, struct msg_slot_txn __user *uarg);
+static long write_many(struct message_slot *slot, struct msg_slot_write_many __user *uarg);
+static long export_slot(struct message_slot *slot, struct msg_slot_snapshot __user *uarg);
+static int import_large_record(struct message_slot *slot, const struct msg_slot_record *rec,
+                               const char __user *data);
+static long import_slot(struct message_slot *slot, struct msg_slot_snapshot __user *uarg);
+static long read_if_newer(struct message_file *mfile, struct msg_slot_read __user *uarg);
+static long read_at(struct message_file *mfile, struct msg_slot_read_at __user *uarg);
+static long watch_eventfd(struct message_file *mfile, struct msg_slot_eventfd __user *uarg);
+static long unwatch_eventfd(struct message_file *mfile, struct msg_slot_eventfd __user *uarg);
+static u32 *copy_channel_ids(u64 uptr, u32 count);
+static struct message_watch *find_watch(struct message_watch_list *list, const void *owner,
+                                        struct eventfd_ctx *eventfd);
+static int add_watch(struct message_slot *slot, unsigned int channel_id, const void *owner,
+                     struct list_head *owner_watches, struct file *efile, struct message_queue *queue);
+static void free_watch(struct rcu_head *rcu);
+static void remove_watch(struct message_slot *slot, struct message_watch *watch);
+static long subscribe(struct message_file *mfile, struct msg_slot_subscribe __user *uarg);
+static long unsubscribe(struct message_file *mfile, struct msg_slot_subscribe __user *uarg);
+static struct message_queue *get_queue(struct message_slot *slot, int fd, struct file **qfile);
+static void queue_change(struct message_watch *watch);
+static void release_queue_watches(struct message_queue *queue);
+static ssize_t queue_read(struct file *, char __user *, size_t, loff_t *);
+static __poll_t queue_poll(struct file *, poll_table *);
+static int queue_release(struct inode *, struct file *);
+static void notify_watchers(struct message_slot *slot, unsigned int channel_id);
+static void report_error(enum message_slot_error error, int minor);
+static unsigned long error_total(enum message_slot_error error);
+static ssize_t device_read(struct kiocb *, struct iov_iter *);
+static ssize_t device_write(struct kiocb *, struct iov_iter *);
+static ssize_t device_splice_write(struct pipe_inode_info *pipe, struct file *out, loff_t *ppos,
+                                   size_t len, unsigned int flags);
 
-// Structure that declares the usual file access functions
+// Structure that declares the usual file access functions. Reads and writes go through
+// iov_iter so splice() and sendfile() move messages to and from pipes without a user copy.
+// A splice carries at most one pipe's worth of data, see device_splice_write().
 static struct file_operations fops = {
         .owner = THIS_MODULE,
         .open = device_open,
+        .release = device_release,
         .unlocked_ioctl = device_ioctl,
-        .read = device_read,
-        .write = device_write,
+        .read_iter = device_read,
+        .write_iter = device_write,
+        .splice_read = copy_splice_read,
+        .splice_write = device_splice_write,
+};
+
+// File operations of the notification fds created by MSG_SLOT_SUBSCRIBE
+static const struct file_operations queue_fops = {
+        .owner = THIS_MODULE,
+        .release = queue_release,
+        .read = queue_read,
+        .poll = queue_poll,
+        .llseek = noop_llseek,
+};
+
+/**
+Slots indexed by minor number, there wo'nt be more than nr_minors slots
+and each slot will not have more than its channel hard limit (2^20 by default).
+A slot is published once on the first open of its minor and never moves,
+so every later open resolves it with a single load and writes nothing shared.
+ */
+static struct message_slot **slots __read_mostly;
+
+/**
+Out of line messages come from one cache per size class, so a message wastes at most
+half of its buffer and a class never shares slabs with unrelated kmalloc users.
+ */
+static struct kmem_cache *payload_caches[MSG_SLOT_PAYLOAD_CLASSES];
+static const char *const payload_cache_names[MSG_SLOT_PAYLOAD_CLASSES] = {
+    "message_slot_128", "message_slot_256", "message_slot_512",
+    "message_slot_1k", "message_slot_2k", "message_slot_4k",
+};
+
+// Character device region, cdev and device class of the module
+static dev_t message_slot_devt;
+static struct cdev message_slot_cdev;
+
+// /sys/class/message_slot/major reports the dynamically allocated major number
+static ssize_t major_show(const struct class *class, const struct class_attribute *attr, char *buf) {
+    return sysfs_emit(buf, "%u\n", MAJOR(message_slot_devt));
+}
+static CLASS_ATTR_RO(major);
+
+static struct attribute *message_slot_class_attrs[] = {
+    &class_attr_major.attr,
+    NULL,
+};
+
+/**
+Failure counters. Failures on the write and open paths can come by the million from an
+abusive client or under memory pressure, so each is a per CPU increment and the kernel
+log only gets a summary with the running total, at most once per ERROR_REPORT_INTERVAL
+for each kind of failure.
+ */
+static DEFINE_PER_CPU(unsigned long [MSG_SLOT_NR_ERRORS], error_counts);
+static unsigned long error_report_at[MSG_SLOT_NR_ERRORS];   // jiffies of the next allowed summary
+#define ERROR_REPORT_INTERVAL (5 * HZ)
+
+static const char *const error_names[MSG_SLOT_NR_ERRORS] = {
+    [MSG_SLOT_ERR_OPEN_NOMEM] = "open_nomem",
+    [MSG_SLOT_ERR_CHANNEL_NOMEM] = "channel_nomem",
+    [MSG_SLOT_ERR_CHANNEL_LIMIT] = "channel_limit",
+    [MSG_SLOT_ERR_SOFT_LIMIT] = "channel_soft_limit",
+    [MSG_SLOT_ERR_QUOTA] = "quota",
+};
+
+// /sys/class/message_slot/errors/<name> reports the total of one failure counter
+struct error_attribute {
+    struct class_attribute attr;
+    enum message_slot_error error;
+};
+
+static ssize_t error_show(const struct class *class, const struct class_attribute *attr, char *buf) {
+    const struct error_attribute *eattr = container_of_const(attr, struct error_attribute, attr);
+
+    return sysfs_emit(buf, "%lu\n", error_total(eattr->error));
+}
+
+#define ERROR_ATTR(_error, _name) \
+    static struct error_attribute error_attr_##_name = { __ATTR(_name, 0444, error_show, NULL), _error }
+
+ERROR_ATTR(MSG_SLOT_ERR_OPEN_NOMEM, open_nomem);
+ERROR_ATTR(MSG_SLOT_ERR_CHANNEL_NOMEM, channel_nomem);
+ERROR_ATTR(MSG_SLOT_ERR_CHANNEL_LIMIT, channel_limit);
+ERROR_ATTR(MSG_SLOT_ERR_SOFT_LIMIT, channel_soft_limit);
+ERROR_ATTR(MSG_SLOT_ERR_QUOTA, quota);
+
+static struct attribute *message_slot_error_attrs[] = {
+    &error_attr_open_nomem.attr.attr,
+    &error_attr_channel_nomem.attr.attr,
+    &error_attr_channel_limit.attr.attr,
+    &error_attr_channel_soft_limit.attr.attr,
+    &error_attr_quota.attr.attr,
+    NULL,
+};
+
+static const struct attribute_group message_slot_class_group = {
+    .attrs = message_slot_class_attrs,
+};
+
+static const struct attribute_group message_slot_error_group = {
+    .name = "errors",
+    .attrs = message_slot_error_attrs,
+};
+
+static const struct attribute_group *message_slot_class_groups[] = {
+    &message_slot_class_group,
+    &message_slot_error_group,
+    NULL,
+};
+
+static struct class message_slot_class = {
+    .name = "message_slot",
+    .class_groups = message_slot_class_groups,
 };
 
 // Module initialization function
 static int __init message_slot_init(void) {
+    struct device *dev;
+    unsigned int minor;
     int result;
-    // Register the device - we're using a predefined major number
-    result = register_chrdev(MAJOR_NUM, "message_slot", &fops);
+    int i;
+
+    if (nr_minors == 0 || nr_minors > MSG_SLOT_MAX_MINORS) {
+        printk(KERN_ERR "message_slot: nr_minors must be between 1 and %u\n", MSG_SLOT_MAX_MINORS);
+        return -EINVAL;
+    }
+
+    slots = kvcalloc(nr_minors, sizeof(*slots), GFP_KERNEL);
+    if (!slots) {
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < MSG_SLOT_NR_ERRORS; i++) {
+        error_report_at[i] = jiffies;
+    }
+
+    for (i = 0; i < MSG_SLOT_PAYLOAD_CLASSES; i++) {
+        payload_caches[i] = kmem_cache_create(payload_cache_names[i],
+                                              sizeof(struct message_payload) + (MSG_SLOT_INLINE_LEN << i),
+                                              0, SLAB_ACCOUNT, NULL);
+        if (!payload_caches[i]) {
+            result = -ENOMEM;
+            goto err_destroy_caches;
+        }
+    }
+
+    // Register the device region - the major number is picked by the kernel
+    result = alloc_chrdev_region(&message_slot_devt, 0, nr_minors, "message_slot");
+    if (result < 0) {
+        printk(KERN_ERR "message_slot: cannot allocate a major number\n");
+        goto err_destroy_caches;
+    }
+
+    cdev_init(&message_slot_cdev, &fops);
+    message_slot_cdev.owner = THIS_MODULE;
+    result = cdev_add(&message_slot_cdev, message_slot_devt, nr_minors);
+    if (result < 0) {
+        goto err_unregister_region;
+    }
+
+    // The class lets udev create /dev/message_slot<minor> for every minor
+    result = class_register(&message_slot_class);
     if (result < 0) {
-        printk(KERN_ERR "message_slot: cannot obtain major number %d\n", MAJOR_NUM);
-        return result;
+        goto err_del_cdev;
+    }
+
+    for (minor = 0; minor < nr_minors; minor++) {
+        dev = device_create(&message_slot_class, NULL, MKDEV(MAJOR(message_slot_devt), minor),
+                            NULL, "message_slot%u", minor);
+        if (IS_ERR(dev)) {
+            result = PTR_ERR(dev);
+            goto err_destroy_devices;
+        }
     }
 
-    printk(KERN_INFO "Inserting message_slot module\n");
+    printk(KERN_INFO "Inserting message_slot module, major %u with %u minors\n",
+           MAJOR(message_slot_devt), nr_minors);
     return 0;
+
+err_destroy_devices:
+    while (minor--) {
+        device_destroy(&message_slot_class, MKDEV(MAJOR(message_slot_devt), minor));
+    }
+    class_unregister(&message_slot_class);
+err_del_cdev:
+    cdev_del(&message_slot_cdev);
+err_unregister_region:
+    unregister_chrdev_region(message_slot_devt, nr_minors);
+err_destroy_caches:
+    for (i = 0; i < MSG_SLOT_PAYLOAD_CLASSES; i++) {
+        kmem_cache_destroy(payload_caches[i]); // NULL for caches not created
+    }
+    kvfree(slots);
+    return result;
 }
 
 // Module cleanup function
 static void __exit message_slot_exit(void) {
+    struct message_slot *slot;
+    struct message_channel *channel;
+    unsigned long index;
+    unsigned int minor;
+    int i;
+
     // Unregister the device
-    unregister_chrdev(MAJOR_NUM, "message_slot");
+    for (minor = 0; minor < nr_minors; minor++) {
+        device_destroy(&message_slot_class, MKDEV(MAJOR(message_slot_devt), minor));
+    }
+    class_unregister(&message_slot_class);
+    cdev_del(&message_slot_cdev);
+    unregister_chrdev_region(message_slot_devt, nr_minors);
+
+    // No file can be open any more, so the slot index holds the last reference of every channel
+    for (minor = 0; minor < nr_minors; minor++) {
+        slot = slots[minor];
+        if (!slot) {
+            continue;
+        }
+        slots[minor] = NULL;
+        cancel_delayed_work_sync(&slot->evict_work);
+        xa_for_each(&slot->channels, index, channel) {
+            xa_erase(&slot->channels, index);
+            put_channel(channel);
+        }
+        xa_destroy(&slot->channels);
+        xa_destroy(&slot->watches);
+        free_slot(slot);
+    }
+    kvfree(slots);
+    rcu_barrier(); // Watches are freed by RCU callbacks of this module
+    for (i = 0; i < MSG_SLOT_PAYLOAD_CLASSES; i++) {
+        kmem_cache_destroy(payload_caches[i]);
+    }
     printk(KERN_INFO "Removing message_slot module\n");
 }
 
-/**
-Head of slots lists , there wo'nt be more than 256 slots
-and each slot will not have more than 2^20 channels as needed
- */
-static struct message_slot *slots = NULL; // Head of the slots list
-
 
 static int device_open(struct inode *inode, struct file *file) {
-    struct message_slot *slot = NULL;
-    struct message_slot **ptr = &slots; // Pointer to the head of the list
+    struct message_slot *slot;
+    struct message_slot *winner;
+    struct message_file *mfile;
     int minor = iminor(inode);
+    int node;
+    int i;
 
-    // Search for an existing slot with the given minor number
-    while (*ptr != NULL) {
-        if ((*ptr)->minor == minor) {
-            // Found the slot, break from the loop
-            slot = *ptr;
-            break;
-        }
-        ptr = &((*ptr)->next);
+    if (minor >= nr_minors) {
+        return -ENODEV;
+    }
+
+    // Look up the slot of this minor number, pairs with the cmpxchg in the creation below
+    slot = smp_load_acquire(&slots[minor]);
+
+    mfile = kmalloc(sizeof(struct message_file), GFP_KERNEL_ACCOUNT);
+    if (!mfile) {
+        report_error(MSG_SLOT_ERR_OPEN_NOMEM, minor);
+        return -ENOMEM;
     }
 
-    // If the slot wasn't found, create a new one
+    // If the slot wasn't found, create a new one. Only the first open of a minor gets
+    // here, concurrent first opens race on the cmpxchg and the losers free their copy.
     if (!slot) {
-        slot = kmalloc(sizeof(struct message_slot), GFP_KERNEL);
+        // An invalid module parameter falls back to local allocation
+        node = READ_ONCE(slot_numa_node);
+        if (!valid_numa_node(node)) {
+            node = MSG_SLOT_NUMA_LOCAL;
+        }
+        slot = kmalloc_node(sizeof(struct message_slot), GFP_KERNEL_ACCOUNT,
+                            node >= 0 ? node : NUMA_NO_NODE);
         if (!slot) {
-            printk(KERN_ERR "message_slot: Out of memory\n");
+            report_error(MSG_SLOT_ERR_OPEN_NOMEM, minor);
+            kfree(mfile);
             return -ENOMEM;
         }
 
         // Initialize the new slot
-        slot->channels = NULL;
-        slot->channel_count = 0;
+        xa_init(&slot->channels);
+        for (i = 0; i < MSG_SLOT_LOCK_STRIPES; i++) {
+            spin_lock_init(&slot->locks[i]);
+        }
+        mutex_init(&slot->txn_lock);
+        seqcount_mutex_init(&slot->txn_seq, &slot->txn_lock);
+        xa_init(&slot->watches);
+        mutex_init(&slot->watch_lock);
+        atomic_long_set(&slot->channel_count, 0);
+        slot->ttl = 0;
+        atomic_long_set(&slot->evicted, 0);
+        atomic_long_set(&slot->mem_used, 0);
+        slot->mem_quota = READ_ONCE(slot_mem_quota);
+        slot->channel_soft_limit = READ_ONCE(slot_channel_soft_limit);
+        slot->channel_hard_limit = READ_ONCE(slot_channel_hard_limit);
+        if (slot->channel_hard_limit && slot->channel_soft_limit > slot->channel_hard_limit) {
+            slot->channel_soft_limit = 0; // Inconsistent module parameters, keep the hard limit
+        }
+        slot->numa_node = node;
+        slot->compress_threshold = READ_ONCE(slot_compress_threshold);
+        atomic64_set(&slot->compressed_in, 0);
+        atomic64_set(&slot->compressed_out, 0);
+        atomic64_set(&slot->compress_ns, 0);
+        atomic64_set(&slot->decompress_ns, 0);
+        atomic64_set(&slot->packed_serial, 0);
+        INIT_DELAYED_WORK(&slot->evict_work, evict_idle_channels);
         slot->minor = minor;
-        slot->next = NULL;
 
-        // Link the new slot into the list
-        *ptr = slot;
+        // Publish the fully initialized slot in the table, cmpxchg implies a full barrier
+        winner = cmpxchg(&slots[minor], NULL, slot);
+        if (winner) {
+            free_slot(slot);
+            slot = winner;
+        }
     }
 
-    // Store a pointer to the slot in file's private data for future operations
-    file->private_data = slot;
+    // Store the per file state in file's private data for future operations
+    mfile->slot = slot;
+    mfile->channel_id = 0;
+    mfile->log_cursor = 0;
+    mfile->stream = false;
+    mfile->stream_seq = 0;
+    mfile->unpacked = NULL;
+    INIT_LIST_HEAD(&mfile->watches);
+    file->private_data = mfile;
 
     return 0; // Success
 }
 
 
+// Frees an empty slot
+static void free_slot(struct message_slot *slot) {
+    mutex_destroy(&slot->watch_lock);
+    mutex_destroy(&slot->txn_lock);
+    kfree(slot);
+}
+
+
+static int device_release(struct inode *inode, struct file *file) {
+    struct message_file *mfile = file->private_data;
+    struct message_watch *watch;
+    struct message_watch *tmp;
+
+    // Channels belong to the slot, only the per file state and its watches go away
+    if (!list_empty(&mfile->watches)) {
+        mutex_lock(&mfile->slot->watch_lock);
+        list_for_each_entry_safe(watch, tmp, &mfile->watches, owner_node) {
+            remove_watch(mfile->slot, watch);
+        }
+        mutex_unlock(&mfile->slot->watch_lock);
+    }
+    free_unpacked(mfile->slot, mfile->unpacked);
+    kfree(mfile);
+    return 0;
+}
+
+
 /**
  * @brief Handles IOCTL commands for the message slot device.
  *
- * This function is specifically designed to set the current channel for the
- * message slot device based on a non-zero channel ID provided by the user. It
- * validates the IOCTL command and the channel ID, ensuring that the command
- * is supported and the channel ID is non-zero.
+ * MSG_SLOT_CHANNEL sets the current channel for the file descriptor based on a
+ * non-zero channel ID provided by the user. The channel itself is only allocated by
+ * the first write to it, so probing readers do not create channels. MSG_SLOT_LIST
+ * reports one page of the channels that exist in the slot, see list_channels().
+ * MSG_SLOT_DELETE removes a channel from the slot, see delete_channel().
+ * MSG_SLOT_SET_TTL turns on eviction of idle channels, see set_ttl(),
+ * MSG_SLOT_SET_QUOTA sets the slot's byte budget (CAP_SYS_ADMIN only),
+ * MSG_SLOT_SET_CHANNEL_LIMITS its channel limits (CAP_SYS_ADMIN only, see
+ * set_channel_limits()), MSG_SLOT_SET_NUMA_NODE its memory placement (see
+ * set_numa_node()), MSG_SLOT_SET_COMPRESSION the length past which messages are
+ * compressed (see set_compression()), MSG_SLOT_SET_READ_MODE switches the file between
+ * whole-message and stream reads (see read_stream()), MSG_SLOT_SET_BROADCAST switches
+ * a channel to broadcast mode (see set_broadcast()), MSG_SLOT_READ_IF_NEWER reads a
+ * message only if it changed (see read_if_newer()), MSG_SLOT_READ_AT reads part of a
+ * message at an offset (see read_at()), MSG_SLOT_CAS writes a message only if it did
+ * not (see compare_and_swap()), MSG_SLOT_TXN_WRITE and MSG_SLOT_TXN_READ write and
+ * read several channels atomically (see txn_write() and txn_read()),
+ * MSG_SLOT_WRITE_MANY writes one message to many channels (see write_many()),
+ * MSG_SLOT_EXPORT and MSG_SLOT_IMPORT move a whole slot to and from a record stream
+ * (see export_slot() and import_slot()), MSG_SLOT_WATCH_EVENTFD and
+ * MSG_SLOT_UNWATCH_EVENTFD bind an eventfd to channel updates (see watch_eventfd()),
+ * MSG_SLOT_SUBSCRIBE and MSG_SLOT_UNSUBSCRIBE manage notification fds that report
+ * which channels changed (see subscribe()) and MSG_SLOT_STATS reports the slot's
+ * counters.
  *
  * @param file A pointer to the file structure representing an open device file.
- *             This structure provides context for the IOCTL operation, including
- *             any previously associated channel or slot information.
- * @param ioctl_num The IOCTL command number. This function specifically handles
- *                  the MSG_SLOT_CHANNEL command, setting the current channel ID.
- * @param ioctl_param The parameter for the IOCTL command, used here as the channel ID.
- *                    This must be a non-zero value to be considered valid.
- *
- * @return Returns 0 on successful execution, indicating that the channel has been
- *         successfully set for subsequent operations. If an error occurs, such as
- *         an unsupported IOCTL command, an invalid channel ID, or if the channel
- *         cannot be set for any reason, the function returns -1. It is expected that
- *         user space interprets this return value as an indication to set errno to
- *         EINVAL, though the actual setting of errno must be handled in user space
- *         based on the negative return value.
+ *             Its private data holds the slot and the currently selected channel ID.
+ * @param ioctl_num The IOCTL command number, one of the MSG_SLOT_* commands.
+ * @param ioctl_param The parameter for the IOCTL command. For MSG_SLOT_CHANNEL and
+ *                    MSG_SLOT_DELETE this is the channel ID and must be non-zero, for
+ *                    MSG_SLOT_SET_TTL it is the idle time in seconds, for
+ *                    MSG_SLOT_SET_NUMA_NODE it is the node or policy, for
+ *                    MSG_SLOT_SET_COMPRESSION the threshold, for MSG_SLOT_SET_READ_MODE
+ *                    the mode and for the others it is a user pointer to the command's
+ *                    argument.
+ *
+ * @return Returns 0 on successful execution. An unsupported IOCTL command or an invalid
+ *         channel ID returns -EINVAL and a bad user pointer returns -EFAULT. Deleting a
+ *         missing channel returns -ENOENT. Setting the quota or the channel limits
+ *         without CAP_SYS_ADMIN returns -EPERM.
  */
 static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned long ioctl_param) {
-    struct message_slot *slot; // Declaration at the start
-    struct message_channel *channel;
-    // Validate the IOCTL command and channel ID
-    if (ioctl_num != MSG_SLOT_CHANNEL || ioctl_param == 0) {
-        // Following instructions: Return -1 for error with an implication that errno should be set to EINVAL
-        return -EINVAL;
-    }
+    struct message_file *mfile = file->private_data;
+    u64 quota;
 
-    // Assuming get_or_create_channel is implemented elsewhere and correctly handles channel management
-    slot = file->private_data;
-    if (!slot) {
-        // Normally, would return -EBADF; per instructions, return -1
-        return -EINVAL;
-    }
+    switch (ioctl_num) {
+    case MSG_SLOT_CHANNEL:
+        // Validate the channel ID
+        if (ioctl_param == 0 || ioctl_param > UINT_MAX) {
+            return -EINVAL;
+        }
 
-    channel = get_or_create_channel(slot, (unsigned int)ioctl_param);
-    if (!channel) {
-        // Assuming channel creation failure due to memory allocation issues; per instructions, return -1
-        return -EINVAL;
-    }
+        // Remember the selected channel for subsequent read/write operations,
+        // a broadcast log is read from its oldest message on
+        mfile->channel_id = (unsigned int)ioctl_param;
+        mfile->log_cursor = 0;
+        mfile->stream_seq = 0;
+        file->f_pos = 0;
+        return 0; // Success
 
-    // Update private_data to point to the selected channel; this is a simplified approach
-    // In a complete implementation, you might need to associate the channel more directly
-    // with read/write operations or maintain the slot and channel relationship differently
-    file->private_data = (void*)channel;
+    case MSG_SLOT_SET_READ_MODE:
+        if (ioctl_param != MSG_SLOT_READ_WHOLE && ioctl_param != MSG_SLOT_READ_STREAM) {
+            return -EINVAL;
+        }
+        mfile->stream = ioctl_param == MSG_SLOT_READ_STREAM;
+        mfile->stream_seq = 0;
+        file->f_pos = 0;
+        return 0;
 
-    return 0; // Success
+    case MSG_SLOT_DELETE:
+        if (ioctl_param == 0 || ioctl_param > UINT_MAX) {
+            return -EINVAL;
+        }
+        return delete_channel(mfile->slot, (unsigned int)ioctl_param);
+
+    case MSG_SLOT_SET_TTL:
+        return set_ttl(mfile->slot, ioctl_param);
+
+    case MSG_SLOT_SET_QUOTA:
+        // The quota protects the whole system, 0 even lifts it, so only an admin moves it
+        if (!capable(CAP_SYS_ADMIN)) {
+            return -EPERM;
+        }
+        if (copy_from_user(&quota, (u64 __user *)ioctl_param, sizeof(quota))) {
+            return -EFAULT;
+        }
+        // A quota below the current usage only stops further allocations
+        WRITE_ONCE(mfile->slot->mem_quota, (unsigned long)quota);
+        return 0;
+
+    case MSG_SLOT_SET_NUMA_NODE:
+        return set_numa_node(mfile->slot, (int)ioctl_param);
+
+    case MSG_SLOT_SET_CHANNEL_LIMITS:
+        return set_channel_limits(mfile->slot, (struct msg_slot_limits __user *)ioctl_param);
+
+    case MSG_SLOT_SET_BROADCAST:
+        return set_broadcast(mfile->slot, (struct msg_slot_broadcast __user *)ioctl_param);
+
+    case MSG_SLOT_SET_COMPRESSION:
+        return set_compression(mfile->slot, ioctl_param);
+
+    case MSG_SLOT_READ_IF_NEWER:
+        return read_if_newer(mfile, (struct msg_slot_read __user *)ioctl_param);
+
+    case MSG_SLOT_READ_AT:
+        return read_at(mfile, (struct msg_slot_read_at __user *)ioctl_param);
+
+    case MSG_SLOT_CAS:
+        return compare_and_swap(mfile, (struct msg_slot_cas __user *)ioctl_param);
+
+    case MSG_SLOT_TXN_WRITE:
+        return txn_write(mfile->slot, (struct msg_slot_txn __user *)ioctl_param);
+
+    case MSG_SLOT_TXN_READ:
+        return txn_read(mfile->slot, (struct msg_slot_txn __user *)ioctl_param);
+
+    case MSG_SLOT_WRITE_MANY:
+        return write_many(mfile->slot, (struct msg_slot_write_many __user *)ioctl_param);
+
+    case MSG_SLOT_EXPORT:
+        return export_slot(mfile->slot, (struct msg_slot_snapshot __user *)ioctl_param);
+
+    case MSG_SLOT_IMPORT:
+        return import_slot(mfile->slot, (struct msg_slot_snapshot __user *)ioctl_param);
+
+    case MSG_SLOT_WATCH_EVENTFD:
+        return watch_eventfd(mfile, (struct msg_slot_eventfd __user *)ioctl_param);
+
+    case MSG_SLOT_UNWATCH_EVENTFD:
+        return unwatch_eventfd(mfile, (struct msg_slot_eventfd __user *)ioctl_param);
+
+    case MSG_SLOT_SUBSCRIBE:
+        return subscribe(mfile, (struct msg_slot_subscribe __user *)ioctl_param);
+
+    case MSG_SLOT_UNSUBSCRIBE:
+        return unsubscribe(mfile, (struct msg_slot_subscribe __user *)ioctl_param);
+
+    case MSG_SLOT_STATS:
+        return get_stats(mfile->slot, (struct msg_slot_stats __user *)ioctl_param);
+
+    case MSG_SLOT_LIST:
+        return list_channels(mfile->slot, (struct msg_slot_list __user *)ioctl_param);
+
+    default:
+        return -EINVAL;
+    }
 }
 
 
@@ -164,163 +689,2800 @@ static long device_ioctl(struct file *file, unsigned int ioctl_num, unsigned lon
  *
  * This function searches for a channel with the given ID within the specified message slot.
  * If the channel does not exist, it creates a new one, assuming the total number of channels
- * does not exceed the maximum limit of 2^20. This limit ensures the module adheres to the
- * assignment's specifications regarding the maximum number of message channels per message slot.
+ * does not exceed the slot's hard limit (2^20 unless configured otherwise, see
+ * set_channel_limits()).
  *
  * Parameters:
  * @slot: Pointer to the message_slot structure within which the channel is to be searched for or created.
  * @channel_id: The unique identifier for the channel to search for or create.
  *
  * Return:
- * - On success, returns a pointer to the message_channel structure, either found or newly created.
- * - Returns NULL if the channel could not be created due to memory allocation failure or if adding
- *   another channel would exceed the maximum limit of 2^20 channels per message slot.
+ * - On success, returns a pointer to the message_channel structure, either found or newly created,
+ *   with a reference held for the caller that must be dropped with put_channel().
+ * - Returns ERR_PTR(-ENOSPC) if adding another channel would exceed the slot's hard limit,
+ *   ERR_PTR(-EDQUOT) if the channel does not fit in the slot's memory
+ *   quota and ERR_PTR(-ENOMEM) on memory allocation failure.
  *
  * Note:
- * The function checks if the total number of channels in the slot has reached the limit of 2^20.
- * If so, it refrains from creating a new channel and returns NULL. This behavior is crucial for
- * preventing the message slot from exceeding the specified maximum number of channels, ensuring
- * compliance with the assignment's constraints. Memory allocation failures also result in a NULL return,
- * signaling an inability to create a new channel under current memory constraints.
- */
-struct message_channel *get_or_create_channel(struct message_slot *slot, unsigned int channel_id) {
-    struct message_channel *current_channel = slot->channels;
-    struct message_channel *prev_channel = NULL;
+ * Channels are indexed by ID in the slot's xarray, so the lookup does not depend on the number
+ * of channels and the slot can be walked in ID order (see list_channels()). Neither finding nor
+ * creating a channel takes a lock of this module: a new channel is allocated optimistically and
+ * published with a compare-and-exchange on its empty index entry. When two creators race on the
+ * same ID the loser sees the winner's channel in place of NULL, frees its own copy and returns the
+ * winner's, so concurrent creators agree on one channel and creators of different IDs never wait
+ * for each other beyond the xarray's internal update.
+ * The function checks if the total number of channels in the slot has reached its hard limit.
+ * If so, it refrains from creating a new channel and returns ERR_PTR(-ENOSPC). Crossing the soft
+ * limit only counts and logs it. Both go through report_error(), so a client hammering a full
+ * slot cannot flood the kernel log or stall creators on the console. The channel is charged to
+ * the slot's memory quota and allocated with GFP_KERNEL_ACCOUNT, so it is also accounted to the
+ * memory cgroup of the creator, on the NUMA node chosen for the slot.
+ */
+static struct message_channel *get_or_create_channel(struct message_slot *slot, unsigned int channel_id) {
     struct message_channel *new_channel;
+    struct message_channel *old_channel;
+    unsigned long soft;
+    unsigned long hard;
+    long count;
+    int err;
 
-    // Iterate through existing channels to find a match.
-    while (current_channel != NULL) {
-        if (current_channel->channel_id == channel_id) {
-            // Channel found.
-            return current_channel;
-        }
-        prev_channel = current_channel;
-        current_channel = current_channel->next;
+    // Look for an existing channel with this ID.
+    new_channel = find_channel(slot, channel_id);
+    if (new_channel) {
+        return new_channel; // Channel found.
+    }
+
+    // Check against the slot's channel limits.
+    count = atomic_long_inc_return(&slot->channel_count);
+    hard = READ_ONCE(slot->channel_hard_limit);
+    if (hard && count > hard) {
+        atomic_long_dec(&slot->channel_count);
+        report_error(MSG_SLOT_ERR_CHANNEL_LIMIT, slot->minor);
+        return ERR_PTR(-ENOSPC); // Max limit reached, cannot create more channels.
+    }
+    soft = READ_ONCE(slot->channel_soft_limit);
+    if (soft && count > soft) {
+        report_error(MSG_SLOT_ERR_SOFT_LIMIT, slot->minor);
     }
 
-    // Check against the maximum allowed channels (2^20).
-    if (slot->channel_count >= (1 << 20)) {
-        printk(KERN_WARNING "Exceeded maximum number of channels (2^20).\n");
-        return NULL; // Max limit reached, cannot create more channels.
+    // Charge the channel to the slot's memory quota.
+    err = charge_slot(slot, sizeof(struct message_channel));
+    if (err) {
+        atomic_long_dec(&slot->channel_count);
+        return ERR_PTR(err); // Quota exhausted.
     }
 
     // Allocate memory for a new channel.
-    new_channel = kmalloc(sizeof(struct message_channel), GFP_KERNEL);
+    new_channel = kmalloc_node(sizeof(struct message_channel), GFP_KERNEL_ACCOUNT, slot_node(slot));
     if (!new_channel) {
-        printk(KERN_ERR "Failed to allocate memory for new channel.\n");
-        return NULL; // Memory allocation failed.
+        uncharge_slot(slot, sizeof(struct message_channel));
+        atomic_long_dec(&slot->channel_count);
+        report_error(MSG_SLOT_ERR_CHANNEL_NOMEM, slot->minor);
+        return ERR_PTR(-ENOMEM); // Memory allocation failed.
     }
 
     // Initialize the newly created channel.
     new_channel->channel_id = channel_id;
+    new_channel->payload = NULL;
     new_channel->message_len = 0;
-    new_channel->next = slot->channels; // Add to the start for simplicity.
+    new_channel->last_write_ns = 0;
+    new_channel->seq = 0;
+    new_channel->last_access = jiffies;
+    new_channel->log = NULL;
+    new_channel->slot = slot;
+    refcount_set(&new_channel->refs, 2); // The slot index and the caller
+
+    // Link the new channel to the slot, only if the ID is still free.
+    for (;;) {
+        old_channel = xa_cmpxchg(&slot->channels, channel_id, NULL, new_channel, GFP_KERNEL_ACCOUNT);
+        if (!old_channel) {
+            return new_channel; // Return the newly created channel.
+        }
+        if (xa_is_err(old_channel)) {
+            err = xa_err(old_channel); // Index node allocation failed.
+            report_error(MSG_SLOT_ERR_CHANNEL_NOMEM, slot->minor);
+            break;
+        }
+        // Another creator linked this ID first, use its channel unless it is being
+        // deleted right now, in which case its entry is about to go away.
+        if (refcount_inc_not_zero(&old_channel->refs)) {
+            err = 0;
+            break;
+        }
+        cpu_relax();
+    }
+
+    // Undo the reservation of the channel that was not linked.
+    kfree(new_channel);
+    uncharge_slot(slot, sizeof(struct message_channel));
+    atomic_long_dec(&slot->channel_count);
+    return err ? ERR_PTR(err) : old_channel;
+}
 
-    // Link the new channel to the slot.
-    slot->channels = new_channel;
-    slot->channel_count++; // Increment the total channel count for the slot.
 
-    return new_channel; // Return the newly created channel.
+/**
+ * channel_lock - Returns the lock stripe guarding a channel ID within a slot.
+ *
+ * The stripe serializes updates of the channel's message with readers of it. It is a
+ * spinlock because transactions update messages inside the slot's seqcount write
+ * section, which runs with preemption disabled; nothing sleeps under it. Stripes are
+ * per slot, so different minors never contend with each other.
+ */
+static spinlock_t *channel_lock(struct message_slot *slot, unsigned int channel_id) {
+    return &slot->locks[hash_32(channel_id, MSG_SLOT_LOCK_BITS)];
 }
 
 
 /**
- * @brief Writes a message to the selected channel for the message slot device.
+ * find_channel - Looks up an existing channel without creating it.
  *
- * This function writes a non-empty message of up to 128 bytes from the user's buffer
- * to the channel previously selected by an IOCTL command. It ensures the message
- * does not exceed the maximum allowed length and that a channel has been set for
- * the file descriptor.
- *
- * @param file Pointer to the file structure representing an open file descriptor.
- *        This structure contains private data set by the IOCTL command, which
- *        should point to the currently selected message channel.
- * @param buf User-space buffer containing the message to be written. The message
- *        can contain any sequence of bytes and is not necessarily a C string.
- * @param count Number of bytes to write from the user's buffer to the channel.
- *        This value must be greater than 0 and less than or equal to 128.
- * @param f_pos Position in the file to start writing. This parameter is ignored
- *        in this context, as the message slot channels do not support seeking.
+ * A channel whose last reference is already gone is being deleted and no longer
+ * counts as found.
  *
- * @return On success, returns the number of bytes written. On error, returns -1,
- *         with the expectation that errno is set to EINVAL if no channel has been
- *         set or the message length is invalid, and to EMSGSIZE if the message length
- *         exceeds 128 bytes. Other errors during message copying may also cause
- *         the function to return -1, with the appropriate errno value set by the
- *         calling context in user space.
+ * Return: The channel with a reference held for the caller, or NULL if the slot has
+ * no channel with this ID.
  */
-static ssize_t device_write(struct file *file, const char __user *buf, size_t count, loff_t *f_pos) {
+static struct message_channel *find_channel(struct message_slot *slot, unsigned int channel_id) {
     struct message_channel *channel;
 
-    // Ensure a channel has been selected for the file descriptor
-    if (!file->private_data) {
+    rcu_read_lock();
+    channel = xa_load(&slot->channels, channel_id);
+    if (channel && !refcount_inc_not_zero(&channel->refs)) {
+        channel = NULL;
+    }
+    rcu_read_unlock();
 
-        return -EINVAL; // Channel not set
-        }
+    return channel;
+}
 
-    // Validate the message length
-    if (count == 0 || count > 128) {
-    
-        return -EMSGSIZE; // Invalid message length
-        }
 
-    // Retrieve the selected channel from file's private data
-    channel = (struct message_channel *)file->private_data;
+/**
+ * put_channel - Drops a reference to a channel, freeing it with the last one.
+ *
+ * The memory is uncharged from the slot right away, but the free is deferred past an
+ * RCU grace period because lookups and list_channels() may still be looking at the
+ * channel after it left the slot index.
+ */
+static void put_channel(struct message_channel *channel) {
+    if (refcount_dec_and_test(&channel->refs)) {
+        free_channel(channel);
+    }
+}
+
 
-    // Clear the channel's message buffer and copy the new message from user space
-    memset(channel->message, 0, sizeof(channel->message));
-    if (copy_from_user(channel->message, buf, count)) {
-        return -1; // Failed to copy message from user space
-        }
+// Releases a channel whose last reference is gone
+static void free_channel(struct message_channel *channel) {
+    if (channel->payload) {
+        put_payload(channel->slot, channel->payload);
+    }
+    free_log(channel->slot, channel->log);
+    uncharge_slot(channel->slot, sizeof(struct message_channel));
+    kfree_rcu(channel, rcu);
+}
 
-    // Update the message length for the channel
-    channel->message_len = count;
 
-    return count; // Successfully written, return the number of bytes written
+/**
+ * delete_channel - Removes a channel from a slot and releases its memory.
+ *
+ * The channel is unlinked from the slot index right away, so it stops counting
+ * against the channel limits and the next write with the same ID creates a fresh channel.
+ * Reads and writes already in progress keep their reference to the old channel; the
+ * memory is reclaimed when the last of them lets go.
+ *
+ * @slot: The slot that holds the channel.
+ * @channel_id: The ID of the channel to delete.
+ *
+ * Return: 0 on success, -ENOENT if the slot has no such channel.
+ */
+static long delete_channel(struct message_slot *slot, unsigned int channel_id) {
+    struct message_channel *channel;
+
+    channel = xa_erase(&slot->channels, channel_id);
+    if (!channel) {
+        return -ENOENT;
     }
+    atomic_long_dec(&slot->channel_count);
+    put_channel(channel); // The reference held by the slot index
+    return 0;
+}
 
 
 /**
- * @brief Reads the last message written to the selected channel into the user's buffer.
- * 
- * @param file Pointer to the file structure representing an open file descriptor.
- *        The file's private data is expected to point to the currently selected message channel.
- * @param buf User-space buffer where the read message will be copied.
- * @param count The size of the user's buffer.
- * @param f_pos Ignored in this context as the message slot does not support seeking.
+ * touch_channel - Records an access to a channel for idle eviction.
  *
- * @return The number of bytes read on success. Returns -1 on error, with the expectation
- *         that errno is set to EINVAL if no channel has been set, EWOULDBLOCK if no message
- *         exists on the channel, ENOSPC if the user's buffer is too small, or another appropriate
- *         value for different errors.
+ * Runs on every select, read and write, so it only stores when the jiffies value
+ * actually changed; readers hammering a channel do not keep dirtying its cache line.
+ */
+static void touch_channel(struct message_channel *channel) {
+    unsigned long now = jiffies;
+
+    if (READ_ONCE(channel->last_access) != now) {
+        WRITE_ONCE(channel->last_access, now);
+    }
+}
+
+
+// Period of the eviction worker for a given TTL: half the TTL, at least a second
+static unsigned long evict_interval(unsigned int ttl) {
+    return max_t(unsigned long, (unsigned long)ttl * HZ / 2, HZ);
+}
+
+
+/**
+ * set_ttl - Sets the idle time after which channels of a slot are evicted.
+ *
+ * @slot: The slot to configure.
+ * @seconds: Idle time in seconds, 0 turns eviction off.
+ *
+ * Return: 0 on success, -EINVAL if the TTL does not fit in jiffies.
+ */
+static long set_ttl(struct message_slot *slot, unsigned long seconds) {
+    if (seconds > UINT_MAX / HZ) {
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(slot->ttl, (unsigned int)seconds);
+    if (seconds) {
+        mod_delayed_work(system_wq, &slot->evict_work, evict_interval(seconds));
+    }
+    // With a TTL of 0 the worker sees it on its next run and stops rearming
+    return 0;
+}
+
+
+/**
+ * evict_idle_channels - Delayed work that reclaims channels idle for longer than the TTL.
+ *
+ * Channels in the middle of a read or write hold more than the index reference and
+ * are skipped. The walk goes through the xarray one entry at a time, so it holds no lock
+ * across the slot. Under the xarray lock, refcount_dec_if_one() takes the index's
+ * reference only while it is the last one, and the entry is erased in the same step:
+ * a lookup racing with it either got its reference first, which keeps the channel, or
+ * fails and creates a fresh channel.
  */
-static ssize_t device_read(struct file *file, char __user *buf, size_t count, loff_t *f_pos) {
+static void evict_idle_channels(struct work_struct *work) {
+    struct message_slot *slot = container_of(to_delayed_work(work), struct message_slot, evict_work);
+    unsigned int ttl = READ_ONCE(slot->ttl);
     struct message_channel *channel;
+    struct message_channel *idle;
+    unsigned long deadline;
+    unsigned long index;
 
-    // Ensure a channel has been selected
-    if (!file->private_data) {
-        return -1; // Channel not set, implying errno should be set to EINVAL
+    if (ttl == 0) {
+        return; // Eviction was turned off
     }
+    deadline = jiffies - (unsigned long)ttl * HZ;
 
-    // Retrieve the selected channel
-    channel = (struct message_channel *)file->private_data;
+    xa_for_each(&slot->channels, index, channel) {
+        // xa_for_each() leaves RCU before returning the entry, which may be freed by a
+        // concurrent delete already, so look it up again inside a read section
+        rcu_read_lock();
+        idle = xa_load(&slot->channels, index);
+        if (idle && !time_before(READ_ONCE(idle->last_access), deadline)) {
+            idle = NULL;
+        }
+        if (idle) {
+            // Drop the index's reference only if it is the last one, so no reader or
+            // writer can hold the channel once it is unlinked
+            xa_lock(&slot->channels);
+            if (xa_load(&slot->channels, index) == idle && refcount_dec_if_one(&idle->refs)) {
+                __xa_erase(&slot->channels, index);
+            } else {
+                idle = NULL;
+            }
+            xa_unlock(&slot->channels);
+        }
+        rcu_read_unlock();
 
-    // Check if a message exists in the channel
-    if (channel->message_len == 0) {
-        return -EWOULDBLOCK; // No message exists, implying errno should be set to EWOULDBLOCK
+        if (idle) {
+            atomic_long_dec(&slot->channel_count);
+            atomic_long_inc(&slot->evicted);
+            free_channel(idle);
+        }
+        cond_resched();
+    }
+
+    schedule_delayed_work(&slot->evict_work, evict_interval(ttl));
+}
+
+
+/**
+ * get_stats - Copies the counters of a slot to user space.
+ *
+ * Return: 0 on success, -EFAULT on a bad user pointer.
+ */
+static long get_stats(struct message_slot *slot, struct msg_slot_stats __user *uarg) {
+    struct msg_slot_stats stats;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.channel_count = atomic_long_read(&slot->channel_count);
+    stats.evicted_channels = atomic_long_read(&slot->evicted);
+    stats.mem_used = atomic_long_read(&slot->mem_used);
+    stats.mem_quota = READ_ONCE(slot->mem_quota);
+    stats.numa_node = READ_ONCE(slot->numa_node);
+    stats.ttl_seconds = READ_ONCE(slot->ttl);
+    stats.channel_soft_limit = READ_ONCE(slot->channel_soft_limit);
+    stats.channel_hard_limit = READ_ONCE(slot->channel_hard_limit);
+    stats.compress_threshold = READ_ONCE(slot->compress_threshold);
+    stats.compressed_in = atomic64_read(&slot->compressed_in);
+    stats.compressed_out = atomic64_read(&slot->compressed_out);
+    stats.compress_ns = atomic64_read(&slot->compress_ns);
+    stats.decompress_ns = atomic64_read(&slot->decompress_ns);
+
+    if (copy_to_user(uarg, &stats, sizeof(stats))) {
+        return -EFAULT;
+    }
+    return 0;
+}
+
+
+/**
+ * charge_slot - Accounts memory allocated on behalf of a slot against its quota.
+ *
+ * The charge is taken before the allocation so that concurrent allocators cannot
+ * overshoot the quota together; callers undo it with uncharge_slot() on failure and
+ * when the memory is freed.
+ *
+ * Return: 0 on success, -EDQUOT if the slot's quota would be exceeded.
+ */
+static int charge_slot(struct message_slot *slot, size_t bytes) {
+    unsigned long quota = READ_ONCE(slot->mem_quota);
+    long used = atomic_long_add_return(bytes, &slot->mem_used);
+
+    if (quota && (unsigned long)used > quota) {
+        atomic_long_sub(bytes, &slot->mem_used);
+        report_error(MSG_SLOT_ERR_QUOTA, slot->minor);
+        return -EDQUOT;
     }
+    return 0;
+}
+
+
+static void uncharge_slot(struct message_slot *slot, size_t bytes) {
+    atomic_long_sub(bytes, &slot->mem_used);
+}
 
-    // Ensure the user's buffer is large enough to hold the message
-    if (count < channel->message_len) {
-        return -ENOSPC; // Buffer too small, implying errno should be set to ENOSPC
+
+/**
+ * slot_node - Returns the NUMA node to allocate a slot's memory on.
+ *
+ * With MSG_SLOT_NUMA_FIRST_WRITER the first caller, which is the first channel
+ * creator, pins the slot to its own node; later callers then see that node.
+ *
+ * Return: A node ID, or NUMA_NO_NODE to allocate near the calling CPU.
+ */
+static int slot_node(struct message_slot *slot) {
+    int node = READ_ONCE(slot->numa_node);
+
+    if (node == MSG_SLOT_NUMA_FIRST_WRITER) {
+        // Losing the race means another writer picked the node first
+        cmpxchg(&slot->numa_node, MSG_SLOT_NUMA_FIRST_WRITER, numa_node_id());
+        node = READ_ONCE(slot->numa_node);
     }
+    return node >= 0 ? node : NUMA_NO_NODE;
+}
+
 
-    // Copy the message to the user's buffer
-    if (copy_to_user(buf, channel->message, channel->message_len)) {
-        return -1; // Failed to copy, handle as appropriate, generally implies an error
+/**
+ * valid_numa_node - Checks a node ID or MSG_SLOT_NUMA_* policy given by the user.
+ */
+static bool valid_numa_node(int node) {
+    if (node == MSG_SLOT_NUMA_LOCAL || node == MSG_SLOT_NUMA_FIRST_WRITER) {
+        return true;
+    }
+    return node >= 0 && node < MAX_NUMNODES && node_online(node);
+}
+
+
+/**
+ * set_numa_node - Chooses where new memory of a slot is allocated.
+ *
+ * Only affects allocations made after the call, existing channels stay where they are.
+ *
+ * @slot: The slot to configure.
+ * @node: An online node ID, MSG_SLOT_NUMA_LOCAL or MSG_SLOT_NUMA_FIRST_WRITER.
+ *
+ * Return: 0 on success, -EINVAL for an offline or invalid node.
+ */
+static long set_numa_node(struct message_slot *slot, int node) {
+    if (!valid_numa_node(node)) {
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(slot->numa_node, node);
+    return 0;
+}
+
+
+/**
+ * set_channel_limits - Sets the soft and hard channel limits of a slot.
+ *
+ * Both are plain values read without a lock by get_or_create_channel(), so a creation
+ * racing with the change may still be checked against the old limits. Like the memory
+ * quota the limits guard the system rather than the caller, and a hard limit of 0 lifts
+ * them, so changing them requires CAP_SYS_ADMIN.
+ *
+ * Return: 0 on success, -EPERM without CAP_SYS_ADMIN, -EINVAL if the soft limit exceeds
+ * a set hard limit or a limit does not fit in an unsigned long, -EFAULT on a bad user
+ * pointer.
+ */
+static long set_channel_limits(struct message_slot *slot, struct msg_slot_limits __user *uarg) {
+    struct msg_slot_limits limits;
+
+    if (!capable(CAP_SYS_ADMIN)) {
+        return -EPERM;
+    }
+    if (copy_from_user(&limits, uarg, sizeof(limits))) {
+        return -EFAULT;
+    }
+    if (limits.soft > ULONG_MAX || limits.hard > ULONG_MAX) {
+        return -EINVAL;
+    }
+    if (limits.hard && limits.soft > limits.hard) {
+        return -EINVAL;
+    }
+
+    WRITE_ONCE(slot->channel_soft_limit, (unsigned long)limits.soft);
+    WRITE_ONCE(slot->channel_hard_limit, (unsigned long)limits.hard);
+    return 0;
+}
+
+
+// Number of entries gathered under one RCU read section by list_channels()
+#define LIST_BATCH 64
+/**
+ * list_channels - Reports one page of the channels of a slot, in channel ID order.
+ *
+ * The walk is resumable: the caller passes the last ID it has seen in the cursor and
+ * gets the channels with greater IDs. Entries are gathered in small batches under
+ * rcu_read_lock() and copied to user space outside of it, so no lock is held across
+ * the full walk and a slot with millions of channels can be dumped page by page. The
+ * batch is allocated rather than kept on the kernel stack.
+ *
+ * @slot: The slot to walk.
+ * @uarg: User pointer to a struct msg_slot_list, updated with the new cursor and count.
+ *
+ * Return: 0 on success, -EFAULT on a bad user pointer, -EINVAL on unknown flags or
+ * -ENOMEM.
+ */
+static long list_channels(struct message_slot *slot, struct msg_slot_list __user *uarg) {
+    struct msg_slot_channel_info *batch;
+    struct msg_slot_channel_info __user *entries;
+    struct msg_slot_list req;
+    struct message_channel *channel;
+    unsigned long index;
+    u32 filled = 0;
+    unsigned int n;
+    long ret = 0;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (req.flags & ~MSG_SLOT_LIST_NONEMPTY) {
+        return -EINVAL;
+    }
+    entries = u64_to_user_ptr(req.entries);
+    batch = kmalloc_array(LIST_BATCH, sizeof(*batch), GFP_KERNEL);
+    if (!batch) {
+        return -ENOMEM;
+    }
+    index = req.cursor;
+
+    while (filled < req.count && index < UINT_MAX) {
+        n = 0;
+        index++; // Resume after the last reported channel
+
+        rcu_read_lock();
+        xa_for_each_start(&slot->channels, index, channel, index) {
+            size_t len = READ_ONCE(channel->message_len);
+
+            if ((req.flags & MSG_SLOT_LIST_NONEMPTY) && len == 0) {
+                continue;
+            }
+            batch[n].channel_id = channel->channel_id;
+            batch[n].message_len = len;
+            batch[n].last_write_ns = READ_ONCE(channel->last_write_ns);
+            if (++n == LIST_BATCH || filled + n == req.count) {
+                break;
+            }
+        }
+        rcu_read_unlock();
+
+        if (n == 0) {
+            break; // No more channels
+        }
+        if (copy_to_user(entries + filled, batch, n * sizeof(batch[0]))) {
+            ret = -EFAULT;
+            goto out;
+        }
+        filled += n;
+        index = batch[n - 1].channel_id;
+        req.cursor = index;
+    }
+
+    req.count = filled;
+    if (copy_to_user(uarg, &req, sizeof(req))) {
+        ret = -EFAULT;
+    }
+out:
+    kfree(batch);
+    return ret;
+}
+
+
+/**
+ * set_broadcast - Switches a channel between plain and broadcast mode.
+ *
+ * In broadcast mode every write is also appended to a log of the last depth messages
+ * and each open file reads the log through its own cursor, so every reader sees every
+ * message that is still in the log exactly once. Log entries are shared between the
+ * readers, each read copies straight from the entry to user space. The channel is
+ * created if needed, and the log is charged to the slot's memory quota.
+ *
+ * @slot: The slot that holds the channel.
+ * @uarg: User pointer to a struct msg_slot_broadcast.
+ *
+ * Return: 0 on success, -EFAULT on a bad user pointer, -EINVAL for a zero channel ID or
+ * a depth above MSG_SLOT_BROADCAST_MAX_DEPTH, or the errors of get_or_create_channel().
+ */
+static long set_broadcast(struct message_slot *slot, struct msg_slot_broadcast __user *uarg) {
+    struct msg_slot_broadcast req;
+    struct message_channel *channel;
+    struct message_log *log = NULL;
+    spinlock_t *lock;
+    size_t size;
+    int err;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (req.channel_id == 0 || req.depth > MSG_SLOT_BROADCAST_MAX_DEPTH) {
+        return -EINVAL;
+    }
+
+    channel = get_or_create_channel(slot, req.channel_id);
+    if (IS_ERR(channel)) {
+        return PTR_ERR(channel);
+    }
+
+    if (req.depth) {
+        size = struct_size(log, entries, req.depth);
+        err = charge_slot(slot, size);
+        if (err) {
+            put_channel(channel);
+            return err;
+        }
+        log = kzalloc_node(size, GFP_KERNEL_ACCOUNT, slot_node(slot));
+        if (!log) {
+            uncharge_slot(slot, size);
+            put_channel(channel);
+            return -ENOMEM;
+        }
+        log->head = 0;
+        log->depth = req.depth;
+    }
+
+    // Swap the logs under the channel's lock, the old one is freed outside of it. The
+    // transaction lock keeps the swap out of a txn_write() that checked for logs.
+    lock = channel_lock(slot, channel->channel_id);
+    mutex_lock(&slot->txn_lock);
+    spin_lock(lock);
+    swap(channel->log, log);
+    spin_unlock(lock);
+    mutex_unlock(&slot->txn_lock);
+
+    free_log(slot, log);
+    put_channel(channel);
+    return 0;
+}
+
+
+/**
+ * set_compression - Sets the length past which messages written to a slot are compressed.
+ *
+ * Messages short enough to be stored inline are never compressed. Messages already
+ * stored keep their form, the threshold applies to later writes.
+ *
+ * @slot: The slot to configure.
+ * @threshold: Length in bytes, 0 turns compression off.
+ *
+ * Return: 0 on success, -EINVAL for a threshold past UINT_MAX, -EOPNOTSUPP if the
+ * kernel lacks LZ4.
+ */
+static long set_compression(struct message_slot *slot, unsigned long threshold) {
+    if (threshold > UINT_MAX) {
+        return -EINVAL;
+    }
+    if (threshold && (!IS_ENABLED(CONFIG_LZ4_COMPRESS) || !IS_ENABLED(CONFIG_LZ4_DECOMPRESS))) {
+        return -EOPNOTSUPP;
+    }
+    WRITE_ONCE(slot->compress_threshold, (unsigned int)threshold);
+    return 0;
+}
+
+
+// Whether a message of len bytes may be written, under the max_message_len in force
+static bool message_len_ok(size_t len) {
+    return len > 0 && len <= min_t(unsigned int, READ_ONCE(max_message_len), MSG_SLOT_MAX_MESSAGE_LEN);
+}
+
+
+// Bytes a payload of a size class holding len bytes takes, as charged to its slot
+static size_t payload_size(unsigned int size_class, size_t len) {
+    if (size_class == MSG_SLOT_PAYLOAD_LARGE) {
+        return sizeof(struct message_payload) + len;
+    }
+    return sizeof(struct message_payload) + (MSG_SLOT_INLINE_LEN << size_class);
+}
+
+
+/**
+ * alloc_payload - Allocates a shared payload charged to the slot.
+ *
+ * The payload comes from the smallest size class that holds len bytes. A message too
+ * long for every class is kvmalloc'ed, so a multi megabyte message is backed by
+ * vmalloc'ed pages instead of needing a high order allocation.
+ *
+ * @slot: The slot that pays for the payload until its last reference is put.
+ * @data: The message to copy in, or NULL if the caller fills payload->data.
+ * @len: Length of the message, see message_len_ok().
+ *
+ * Return: The payload with one reference, ERR_PTR(-EDQUOT) past the slot's quota or
+ * ERR_PTR(-ENOMEM).
+ */
+static struct message_payload *alloc_payload(struct message_slot *slot, const char *data, size_t len) {
+    struct message_payload *payload;
+    unsigned int size_class = 0;
+    int err;
+
+    while (size_class < MSG_SLOT_PAYLOAD_LARGE && (MSG_SLOT_INLINE_LEN << size_class) < len) {
+        size_class++;
+    }
+
+    err = charge_slot(slot, payload_size(size_class, len));
+    if (err) {
+        return ERR_PTR(err);
+    }
+    if (size_class == MSG_SLOT_PAYLOAD_LARGE) {
+        payload = kvmalloc_node(payload_size(size_class, len), GFP_KERNEL_ACCOUNT, slot_node(slot));
+    } else {
+        payload = kmem_cache_alloc_node(payload_caches[size_class], GFP_KERNEL_ACCOUNT, slot_node(slot));
+    }
+    if (!payload) {
+        uncharge_slot(slot, payload_size(size_class, len));
+        report_error(MSG_SLOT_ERR_CHANNEL_NOMEM, slot->minor);
+        return ERR_PTR(-ENOMEM);
+    }
+
+    refcount_set(&payload->refs, 1);
+    payload->size_class = size_class;
+    payload->packed_len = 0;
+    payload->len = len;
+    payload->serial = 0;
+    if (data) {
+        memcpy(payload->data, data, len);
+    }
+    return payload;
+}
+
+
+// Drops a reference to a payload, the last one frees it and the slot stops paying for it
+static void put_payload(struct message_slot *slot, struct message_payload *payload) {
+    if (refcount_dec_and_test(&payload->refs)) {
+        uncharge_slot(slot, payload_size(payload->size_class, payload->packed_len ?: payload->len));
+        if (payload->size_class == MSG_SLOT_PAYLOAD_LARGE) {
+            kvfree(payload);
+        } else {
+            kmem_cache_free(payload_caches[payload->size_class], payload);
+        }
+    }
+}
+
+
+/**
+ * copy_message - Takes the current message of a channel for copying it out.
+ *
+ * An inline message is copied to the struct, an out of line one is only referenced, so
+ * taking a long message costs no more under the channel's lock than taking a short one.
+ * Called with the channel's lock held, the copy must be passed to release_copy().
+ */
+static void copy_message(struct message_channel *channel, struct message_copy *copy) {
+    copy->len = channel->message_len;
+    copy->seq = channel->seq;
+    copy->payload = channel->payload;
+    copy->unpacked = NULL;
+    if (copy->payload) {
+        refcount_inc(&copy->payload->refs);
+        copy->data = copy->payload->data;
+    } else {
+        memcpy(copy->inline_data, channel->message, copy->len);
+        copy->data = copy->inline_data;
+    }
+}
+
+
+/**
+ * unpack_copy - Decompresses the message of a copy if it is stored compressed.
+ *
+ * Called without the channel's lock, before copy->data is read. The decompressed
+ * message is charged to the slot like the messages it holds, and freed by release_copy().
+ *
+ * Return: 0 on success, -EIO if the payload does not decompress, or the errors of
+ * charge_slot() and -ENOMEM.
+ */
+static int unpack_copy(struct message_slot *slot, struct message_copy *copy) {
+    struct message_payload *payload = copy->payload;
+    struct message_unpacked *unpacked;
+    size_t size;
+    u64 start;
+    int len;
+    int err;
+
+    if (!payload || !payload->packed_len) {
+        return 0;
+    }
+    if (!IS_ENABLED(CONFIG_LZ4_DECOMPRESS)) {
+        return -EIO; // Not reached, compression needs both directions
+    }
+
+    size = struct_size(unpacked, data, payload->len);
+    err = charge_slot(slot, size);
+    if (err) {
+        return err;
+    }
+    unpacked = kvmalloc(size, GFP_KERNEL_ACCOUNT);
+    if (!unpacked) {
+        uncharge_slot(slot, size);
+        return -ENOMEM;
+    }
+    unpacked->serial = payload->serial;
+    unpacked->size = size;
+    copy->unpacked = unpacked;
+    start = ktime_get_ns();
+    len = LZ4_decompress_safe(payload->data, unpacked->data, payload->packed_len, payload->len);
+    atomic64_add(ktime_get_ns() - start, &slot->decompress_ns);
+    if (WARN_ON_ONCE(len != payload->len)) {
+        return -EIO; // Only our own compressor writes payloads
+    }
+    copy->data = unpacked->data;
+    return 0;
+}
+
+
+// Releases what copy_message() took, the copy may be reused afterwards
+static void release_copy(struct message_slot *slot, struct message_copy *copy) {
+    if (copy->payload) {
+        put_payload(slot, copy->payload);
+        copy->payload = NULL;
+    }
+    free_unpacked(slot, copy->unpacked);
+    copy->unpacked = NULL;
+}
+
+
+// Frees a decompressed message and uncharges it from the slot
+static void free_unpacked(struct message_slot *slot, struct message_unpacked *unpacked) {
+    if (!unpacked) {
+        return;
+    }
+    uncharge_slot(slot, unpacked->size);
+    kvfree(unpacked);
+}
+
+
+/**
+ * unpack_cached - Decompresses the message of a copy, reusing the file's last one.
+ *
+ * Stream reads and MSG_SLOT_READ_AT take a long message in many chunks. Until the last
+ * chunk is read the file keeps the message decompressed, keyed by the payload's serial
+ * rather than its address so no reference to the payload is held, and a read of the
+ * same payload reuses it instead of decompressing the whole message for every chunk.
+ * The cache is taken out of the file for the read and put back by release_cached(), so
+ * concurrent reads of one file never share it and at worst decompress again.
+ *
+ * Return: 0 on success or the errors of unpack_copy().
+ */
+static int unpack_cached(struct message_file *mfile, struct message_copy *copy) {
+    struct message_unpacked *cached;
+
+    if (!copy->payload || !copy->payload->packed_len) {
+        return 0;
+    }
+
+    cached = xchg(&mfile->unpacked, NULL);
+    if (cached && cached->serial == copy->payload->serial) {
+        copy->unpacked = cached;
+        copy->data = cached->data;
+        return 0;
+    }
+    free_unpacked(mfile->slot, cached); // A message the file has moved on from
+    return unpack_copy(mfile->slot, copy);
+}
+
+
+// Releases a copy taken for unpack_cached(). Its decompressed message stays in the file
+// for the next chunk, unless done says the read reached the end of the message.
+static void release_cached(struct message_file *mfile, struct message_copy *copy, bool done) {
+    struct message_unpacked *unpacked = copy->unpacked;
+
+    if (!done && unpacked && copy->data == unpacked->data) {
+        free_unpacked(mfile->slot, xchg(&mfile->unpacked, unpacked));
+        copy->unpacked = NULL;
+    }
+    release_copy(mfile->slot, copy);
+}
+
+
+/**
+ * compress_payload - Compresses a message into a new payload if that saves memory.
+ *
+ * The message is compressed into a scratch buffer an eighth smaller than it, so data
+ * that does not shrink at least that much costs the attempt but no memory, and only
+ * the compressed bytes are kept in the payload. Runs before the channel's lock is taken.
+ *
+ * Return: A payload holding the compressed message, or NULL to store it as is, also
+ * when an allocation fails.
+ */
+static struct message_payload *compress_payload(struct message_slot *slot, const char *data, size_t len) {
+    struct message_payload *payload = NULL;
+    size_t room = len - len / 8;
+    void *wrkmem;
+    char *packed;
+    int packed_len;
+    u64 start;
+
+    if (!IS_ENABLED(CONFIG_LZ4_COMPRESS) || !IS_ENABLED(CONFIG_LZ4_DECOMPRESS)) {
+        return NULL;
+    }
+
+    wrkmem = kvmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+    packed = kvmalloc(room, GFP_KERNEL);
+    if (!wrkmem || !packed) {
+        goto out;
+    }
+
+    start = ktime_get_ns();
+    packed_len = LZ4_compress_default(data, packed, len, room, wrkmem);
+    atomic64_add(ktime_get_ns() - start, &slot->compress_ns);
+    if (packed_len <= 0) {
+        goto out; // Does not fit, the message is not worth compressing
+    }
+
+    payload = alloc_payload(slot, packed, packed_len);
+    if (IS_ERR(payload)) {
+        payload = NULL; // Storing it as is fails the same way and reports why
+        goto out;
+    }
+    payload->packed_len = packed_len;
+    payload->len = len;
+    payload->serial = atomic64_inc_return(&slot->packed_serial);
+    atomic64_add(len, &slot->compressed_in);
+    atomic64_add(packed_len, &slot->compressed_out);
+out:
+    kvfree(packed);
+    kvfree(wrkmem);
+    return payload;
+}
+
+
+/**
+ * pack_message - Compresses a message about to be written if its slot asks for it.
+ *
+ * Compression may take long on a large message, writers call this before
+ * prepare_update() and before anything is locked.
+ *
+ * @slot: The slot the message is written to.
+ * @data: The message, in kernel memory.
+ * @len: Length of the message.
+ * @payload: The payload data lives in, or NULL. Its reference is dropped if the message
+ *           is compressed.
+ *
+ * Return: The payload to pass to prepare_update(). When it is not the one passed in,
+ * data may be gone, which is fine as only inline messages are copied from data and
+ * those are never compressed.
+ */
+static struct message_payload *pack_message(struct message_slot *slot, const char *data, size_t len,
+                                            struct message_payload *payload) {
+    unsigned int threshold = READ_ONCE(slot->compress_threshold);
+    struct message_payload *packed;
+
+    if (!threshold || len <= max_t(unsigned int, threshold, MSG_SLOT_INLINE_LEN)) {
+        return payload;
+    }
+    packed = compress_payload(slot, data, len);
+    if (!packed) {
+        return payload;
+    }
+    if (payload) {
+        put_payload(slot, payload);
+    }
+    return packed;
+}
+
+
+/**
+ * copy_message_in - Copies a message to be written from user space.
+ *
+ * A message that fits inline is copied to kbuf, a longer one straight into a new payload
+ * that prepare_update() then installs as is, so no message is copied twice. Done before
+ * the channel is touched, so a faulting user buffer neither holds a lock nor leaves a
+ * half written message.
+ *
+ * @slot: The slot the message is written to, charged for a payload.
+ * @from: The message, its whole length is copied.
+ * @kbuf: MSG_SLOT_INLINE_LEN bytes for a short message.
+ * @payload: Set to the new payload, or NULL for a short message.
+ *
+ * Return: The message in kernel memory, ERR_PTR(-EFAULT) or the errors of alloc_payload().
+ */
+static const char *copy_message_in(struct message_slot *slot, struct iov_iter *from, char *kbuf,
+                                   struct message_payload **payload) {
+    size_t len = iov_iter_count(from);
+    char *data = kbuf;
+
+    *payload = NULL;
+    if (len > MSG_SLOT_INLINE_LEN) {
+        *payload = alloc_payload(slot, NULL, len);
+        if (IS_ERR(*payload)) {
+            return ERR_CAST(*payload);
+        }
+        data = (*payload)->data;
+    }
+
+    if (copy_from_iter(data, len, from) != len) {
+        if (*payload) {
+            put_payload(slot, *payload);
+        }
+        return ERR_PTR(-EFAULT);
+    }
+    return data;
+}
+
+
+// Frees a broadcast log that no channel points to any more, log may be NULL
+static void free_log(struct message_slot *slot, struct message_log *log) {
+    unsigned int i;
+
+    if (!log) {
+        return;
+    }
+    for (i = 0; i < log->depth; i++) {
+        if (log->entries[i]) {
+            put_payload(slot, log->entries[i]);
+        }
+    }
+    uncharge_slot(slot, struct_size(log, entries, log->depth));
+    kfree(log);
+}
+
+
+/**
+ * read_stream - Copies the next part of a message to a file in stream mode.
+ *
+ * @data: The message, pinned by the caller.
+ * @len: Length of the message.
+ * @iocb: The read, iocb->ki_pos is the offset in the message and is advanced.
+ * @to: The user's buffer, filled as far as the message goes.
+ *
+ * Return: Number of bytes read, 0 once the position reached the end of the message or
+ * for an empty buffer, which leaves the position alone, or -EFAULT.
+ */
+static ssize_t read_stream(const char *data, size_t len, struct kiocb *iocb, struct iov_iter *to) {
+    size_t n;
+
+    if (iocb->ki_pos >= len || iov_iter_count(to) == 0) {
+        return 0;
+    }
+    n = min_t(size_t, len - iocb->ki_pos, iov_iter_count(to));
+    n = copy_to_iter(data + iocb->ki_pos, n, to);
+    if (n == 0 && iov_iter_count(to)) {
+        return -EFAULT;
+    }
+    iocb->ki_pos += n;
+    return n;
+}
+
+
+/**
+ * read_broadcast - Reads the next message of a broadcast channel for one file.
+ *
+ * A file that fell further behind than the log depth skips to the oldest message still
+ * in the log. The cursor only moves past a message once it reached the user's buffer,
+ * in stream mode once the read after its last byte returned 0. A zero-length read
+ * returns 0 without moving it. Called with the channel's lock held, drops it.
+ *
+ * Return: Number of bytes read, -EWOULDBLOCK when the file has read every message,
+ * -ENOSPC if the user's buffer is too small or -EFAULT.
+ */
+static ssize_t read_broadcast(struct message_file *mfile, struct message_channel *channel,
+                              struct kiocb *iocb, struct iov_iter *to) {
+    struct message_log *log = channel->log;
+    struct message_payload *payload;
+    struct message_copy copy;
+    u64 oldest = log->head > log->depth ? log->head - log->depth : 0;
+    u64 cursor = mfile->log_cursor;
+    ssize_t ret;
+
+    // A cursor past the head belongs to an earlier log of this channel
+    if (cursor < oldest || cursor > log->head) {
+        cursor = oldest;
+        iocb->ki_pos = 0; // The message being streamed is gone
+    }
+    if (cursor == log->head) {
+        mfile->log_cursor = cursor;
+        spin_unlock(channel_lock(mfile->slot, channel->channel_id));
+        return -EWOULDBLOCK; // Every message was read
+    }
+    payload = log->entries[cursor % log->depth];
+    refcount_inc(&payload->refs);
+    spin_unlock(channel_lock(mfile->slot, channel->channel_id));
+
+    copy.payload = payload;
+    copy.unpacked = NULL;
+    copy.data = payload->data;
+    copy.len = payload->len;
+    ret = unpack_cached(mfile, &copy);
+    if (ret) {
+        // The cursor stays, the message can be read again
+    } else if (READ_ONCE(mfile->stream)) {
+        ret = read_stream(copy.data, copy.len, iocb, to);
+        if (ret == 0 && iocb->ki_pos >= copy.len) {
+            cursor++; // Done with this message, the next read starts the next one
+            iocb->ki_pos = 0;
+        }
+    } else if (iov_iter_count(to) < copy.len) {
+        ret = -ENOSPC;
+    } else if (copy_to_iter(copy.data, copy.len, to) != copy.len) {
+        ret = -EFAULT;
+    } else {
+        ret = copy.len;
+        cursor++;
+    }
+    // The decompressed message is only kept while a stream read has bytes of it left
+    release_cached(mfile, &copy, cursor != mfile->log_cursor || ret < 0 || iocb->ki_pos >= copy.len);
+    mfile->log_cursor = cursor;
+    return ret;
+}
+
+
+/**
+ * next_seq - Returns the sequence number for the next message of a channel.
+ *
+ * Sequence numbers come from the monotonic clock, bumped by one when two writes land
+ * in the same nanosecond. They grow with every write and a channel recreated after a
+ * deletion or eviction starts above anything its previous incarnation handed out, so a
+ * poller's last seen value never hides a newer message. Called with the channel's lock held.
+ */
+static u64 next_seq(struct message_channel *channel) {
+    return max_t(u64, ktime_get_ns(), channel->seq + 1);
+}
+
+
+/**
+ * read_if_newer - Reads a channel's message only if it is newer than what the caller saw.
+ *
+ * Pollers pass back the sequence number of the message they read last and get nothing
+ * copied while the channel is unchanged. Channels that do not exist are not created.
+ *
+ * @mfile: The file the request came from.
+ * @uarg: User pointer to a struct msg_slot_read, updated with the length and sequence number.
+ *
+ * Return: 0 on success, including when there is nothing newer (len is 0 then). -EINVAL
+ * if no channel is given or selected, -ENOSPC if the buffer is too small for the newer
+ * message, -EFAULT on a bad user pointer.
+ */
+static long read_if_newer(struct message_file *mfile, struct msg_slot_read __user *uarg) {
+    struct msg_slot_read req;
+    struct message_channel *channel;
+    struct message_copy copy;
+    spinlock_t *lock;
+    long ret = 0;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (req.channel_id == 0) {
+        req.channel_id = mfile->channel_id;
+    }
+    if (req.channel_id == 0) {
+        return -EINVAL;
+    }
+
+    copy.len = 0;
+    copy.seq = 0;
+    copy.payload = NULL;
+    copy.unpacked = NULL;
+    channel = find_channel(mfile->slot, req.channel_id);
+    if (channel) {
+        touch_channel(channel);
+
+        // Only copy the message when the caller has not seen it yet
+        lock = channel_lock(mfile->slot, channel->channel_id);
+        spin_lock(lock);
+        if (channel->seq > req.seq) {
+            copy_message(channel, &copy);
+        } else {
+            copy.seq = channel->seq;
+        }
+        spin_unlock(lock);
+        put_channel(channel);
+    }
+
+    if (copy.len > req.len) {
+        req.len = copy.len;
+        ret = copy_to_user(uarg, &req, sizeof(req)) ? -EFAULT : -ENOSPC;
+    } else {
+        ret = unpack_copy(mfile->slot, &copy);
+        if (ret) {
+            // Not enough memory to decompress the message
+        } else if (copy.len && copy_to_user(u64_to_user_ptr(req.buf), copy.data, copy.len)) {
+            ret = -EFAULT;
+        } else {
+            req.len = copy.len;
+            req.seq = copy.seq;
+            if (copy_to_user(uarg, &req, sizeof(req))) {
+                ret = -EFAULT;
+            }
+        }
+    }
+
+    release_copy(mfile->slot, &copy);
+    return ret;
+}
+
+
+/**
+ * read_at - Reads part of a channel's message from an offset.
+ *
+ * The message is pinned under the channel's lock and copied out after the lock is
+ * dropped, so reading a chunk of a multi megabyte message holds the lock no longer
+ * than reading a short one. Channels that do not exist are not created.
+ *
+ * @mfile: The file the request came from.
+ * @uarg: User pointer to a struct msg_slot_read_at, updated with the length copied,
+ *        the sequence number and the length of the message.
+ *
+ * Return: 0 on success, -EINVAL if no channel is given or selected, -EWOULDBLOCK if the
+ * channel holds no message, -ESTALE if it holds another message than seq asks for,
+ * -EFAULT on a bad user pointer.
+ */
+static long read_at(struct message_file *mfile, struct msg_slot_read_at __user *uarg) {
+    struct msg_slot_read_at req;
+    struct message_channel *channel;
+    struct message_copy copy;
+    struct iov_iter to;
+    spinlock_t *lock;
+    size_t len;
+    long ret;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (req.channel_id == 0) {
+        req.channel_id = mfile->channel_id;
+    }
+    if (req.channel_id == 0) {
+        return -EINVAL;
+    }
+    ret = import_ubuf(ITER_DEST, u64_to_user_ptr(req.buf), req.len, &to);
+    if (ret) {
+        return ret;
+    }
+
+    channel = find_channel(mfile->slot, req.channel_id);
+    if (!channel) {
+        return -EWOULDBLOCK;
+    }
+    touch_channel(channel);
+    lock = channel_lock(mfile->slot, channel->channel_id);
+    spin_lock(lock);
+    copy_message(channel, &copy);
+    spin_unlock(lock);
+    put_channel(channel);
+
+    if (copy.len == 0) {
+        ret = -EWOULDBLOCK;
+        goto out;
+    }
+    if (req.seq && req.seq != copy.seq) {
+        ret = -ESTALE; // The message was replaced since the previous chunk
+    } else {
+        ret = unpack_cached(mfile, &copy);
+        if (ret) {
+            goto out;
+        }
+        len = req.offset < copy.len ? min_t(size_t, copy.len - req.offset, iov_iter_count(&to)) : 0;
+        if (copy_to_iter(copy.data + req.offset, len, &to) != len) {
+            ret = -EFAULT;
+            goto out;
+        }
+        req.len = len;
+    }
+
+    req.seq = copy.seq;
+    req.message_len = copy.len;
+    if (copy_to_user(uarg, &req, sizeof(req))) {
+        ret = -EFAULT;
+    }
+out:
+    release_cached(mfile, &copy, ret || req.offset + req.len >= copy.len);
+    return ret;
+}
+
+
+/**
+ * prepare_update - First step of replacing the message of a channel.
+ *
+ * Does everything that can fail or sleep for long before the channel's lock is taken:
+ * finds or creates the channel and puts a message too long to be stored inline, or
+ * written to a broadcast channel, in a payload. A broadcast channel's log shares that
+ * payload with the channel. On success the update must be passed to commit_update()
+ * and finish_update().
+ *
+ * @slot: The slot that holds the channel.
+ * @channel_id: The channel to write.
+ * @data: The message, already copied from user space.
+ * @len: Length of the message.
+ * @payload: The payload data lives in, or NULL. Its reference passes to the update, and
+ *           is dropped on failure.
+ * @create: Whether a missing channel is created or the update fails with -ESTALE.
+ * @update: Filled with the state the next steps need.
+ *
+ * Return: 0 on success, -ESTALE for a missing channel that is not created, or the errors
+ * of get_or_create_channel() and alloc_payload().
+ */
+static int prepare_update(struct message_slot *slot, unsigned int channel_id, const char *data,
+                          size_t len, struct message_payload *payload, bool create,
+                          struct message_update *update) {
+    struct message_channel *channel;
+
+    if (create) {
+        channel = get_or_create_channel(slot, channel_id);
+    } else {
+        channel = find_channel(slot, channel_id) ?: ERR_PTR(-ESTALE);
+    }
+    if (IS_ERR(channel)) {
+        if (payload) {
+            put_payload(slot, payload);
+        }
+        return PTR_ERR(channel);
+    }
+
+    // A long message and a broadcast log entry need a payload, allocate it before locking
+    if (!payload && (len > MSG_SLOT_INLINE_LEN || READ_ONCE(channel->log))) {
+        payload = alloc_payload(slot, data, len);
+        if (IS_ERR(payload)) {
+            put_channel(channel);
+            return PTR_ERR(payload);
+        }
+        data = payload->data;
+    }
+
+    update->channel = channel;
+    update->payload = payload;
+    update->old_message = NULL;
+    update->old_entry = NULL;
+    update->data = data;
+    update->len = len;
+    update->written = false;
+    return 0;
+}
+
+
+/**
+ * commit_update - Replaces the message of a channel under the channel's lock.
+ *
+ * The message, write time and sequence number change together, and on a broadcast
+ * channel the message is appended to the log. A short message is copied into the
+ * channel, a long one is installed by swapping the payload pointer. With expected set
+ * the write only happens if the channel's sequence number equals *expected, 0 standing
+ * for no message.
+ *
+ * prepare_update() decides whether a short message needs a payload before the lock is
+ * taken. If the channel turned into a broadcast channel since, nothing is written and
+ * the caller gives the update a payload with add_log_payload() and commits again.
+ *
+ * Return: 0 on success, -ESTALE if the condition failed, -EAGAIN if the update needs a
+ * payload for the log. *seq, if not NULL, is set to the new sequence number or to the
+ * current one when the condition failed.
+ */
+static int commit_update(struct message_slot *slot, struct message_update *update,
+                         const u64 *expected, u64 *seq) {
+    struct message_channel *channel = update->channel;
+    spinlock_t *lock = channel_lock(slot, channel->channel_id);
+    struct message_log *log;
+    int ret = 0;
+
+    spin_lock(lock);
+    if (expected && channel->seq != *expected) {
+        ret = -ESTALE; // Someone else wrote first, the unused payload is dropped later
+    } else if (!update->payload && channel->log) {
+        ret = -EAGAIN; // Every log entry is a payload, the message would not be logged
+    } else {
+        // What the new message replaces is dropped by finish_update(), outside the lock
+        update->old_message = channel->payload;
+        if (update->len > MSG_SLOT_INLINE_LEN) {
+            refcount_inc(&update->payload->refs);
+            channel->payload = update->payload;
+        } else {
+            channel->payload = NULL;
+            memset(channel->message, 0, sizeof(channel->message));
+            memcpy(channel->message, update->data, update->len);
+        }
+        WRITE_ONCE(channel->message_len, update->len);
+        WRITE_ONCE(channel->last_write_ns, ktime_get_real_ns());
+        channel->seq = next_seq(channel);
+        update->written = true;
+        log = channel->log;
+        if (update->payload && log) {
+            refcount_inc(&update->payload->refs);
+            update->old_entry = log->entries[log->head % log->depth];
+            log->entries[log->head % log->depth] = update->payload;
+            log->head++;
+        }
+    }
+    if (seq) {
+        *seq = channel->seq;
+    }
+    spin_unlock(lock);
+    return ret;
+}
+
+
+// Gives an update prepare_update() left without a payload one, for a channel that has
+// become a broadcast channel since. Called without locks, the update is committed again.
+static int add_log_payload(struct message_slot *slot, struct message_update *update) {
+    struct message_payload *payload = alloc_payload(slot, update->data, update->len);
+
+    if (IS_ERR(payload)) {
+        return PTR_ERR(payload);
+    }
+    update->payload = payload;
+    update->data = payload->data;
+    return 0;
+}
+
+
+// Last step of an update, releases what prepare_update() took and commit_update() replaced
+// and tells the channel's watchers about a committed write
+static void finish_update(struct message_slot *slot, struct message_update *update) {
+    if (update->written) {
+        notify_watchers(slot, update->channel->channel_id);
+    }
+    // The update's own reference, and whatever the commit replaced
+    if (update->payload) {
+        put_payload(slot, update->payload);
+    }
+    if (update->old_message) {
+        put_payload(slot, update->old_message);
+    }
+    if (update->old_entry) {
+        put_payload(slot, update->old_entry);
+    }
+    touch_channel(update->channel);
+    put_channel(update->channel);
+}
+
+
+/**
+ * store_message - Replaces the message of a channel.
+ *
+ * The common part of device_write() and the ioctls that write a single message. With
+ * expected set the write is conditional, see commit_update(). Only an unconditional
+ * write or one expecting 0 creates the channel. A payload holding kbuf is consumed as
+ * by prepare_update(), the message is compressed first if the slot asks for it.
+ *
+ * Return: 0 on success, -ESTALE if the condition failed (*seq is then the current
+ * sequence number, 0 for a missing channel), or the errors of prepare_update().
+ */
+static int store_message(struct message_slot *slot, unsigned int channel_id, const char *kbuf,
+                         size_t count, struct message_payload *payload, const u64 *expected, u64 *seq) {
+    struct message_update update;
+    int ret;
+
+    payload = pack_message(slot, kbuf, count, payload);
+    ret = prepare_update(slot, channel_id, kbuf, count, payload, !expected || !*expected, &update);
+    if (ret) {
+        if (ret == -ESTALE && seq) {
+            *seq = 0;
+        }
+        return ret;
+    }
+
+    ret = commit_update(slot, &update, expected, seq);
+    if (ret == -EAGAIN) {
+        ret = add_log_payload(slot, &update);
+        if (!ret) {
+            ret = commit_update(slot, &update, expected, seq); // Has a payload, cannot race again
+        }
+    }
+    finish_update(slot, &update);
+    return ret;
+}
+
+
+/**
+ * compare_and_swap - Writes a message only if the channel still has the expected version.
+ *
+ * Lets user space use a channel as a shared register: read it with
+ * MSG_SLOT_READ_IF_NEWER, compute the new value and publish it only if nobody wrote in
+ * between, retrying on -ESTALE with the sequence number reported back.
+ *
+ * @mfile: The file the request came from.
+ * @uarg: User pointer to a struct msg_slot_cas, updated with the resulting sequence number.
+ *
+ * Return: 0 on success, -ESTALE if the channel's sequence number is not the expected one,
+ * -EINVAL if no channel is given or selected, -EMSGSIZE for an invalid length, -EFAULT on
+ * a bad user pointer, or the errors of store_message().
+ */
+static long compare_and_swap(struct message_file *mfile, struct msg_slot_cas __user *uarg) {
+    struct msg_slot_cas req;
+    struct message_payload *payload;
+    struct iov_iter from;
+    char kbuf[MSG_SLOT_INLINE_LEN];
+    const char *data;
+    long ret;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (req.channel_id == 0) {
+        req.channel_id = mfile->channel_id;
+    }
+    if (req.channel_id == 0) {
+        return -EINVAL;
+    }
+    if (!message_len_ok(req.len)) {
+        return -EMSGSIZE;
+    }
+    ret = import_ubuf(ITER_SOURCE, u64_to_user_ptr(req.buf), req.len, &from);
+    if (ret) {
+        return ret;
+    }
+    data = copy_message_in(mfile->slot, &from, kbuf, &payload);
+    if (IS_ERR(data)) {
+        return PTR_ERR(data);
+    }
+
+    ret = store_message(mfile->slot, req.channel_id, data, req.len, payload, &req.expected_seq, &req.seq);
+    if (ret && ret != -ESTALE) {
+        return ret;
+    }
+    if (copy_to_user(uarg, &req, sizeof(req))) {
+        return -EFAULT;
+    }
+    return ret;
+}
+
+
+/**
+ * txn_write - Writes several channels of a slot as one transaction.
+ *
+ * Everything that can fail runs first: the entries are validated, then the messages
+ * are copied in, the channels created and payloads allocated. Only then are all messages committed
+ * inside the slot's seqcount write section, so a matching txn_read() sees either none or
+ * all of them. Transaction writers are serialized by the slot's txn_lock, plain writes
+ * are not affected.
+ *
+ * @slot: The slot that holds the channels.
+ * @uarg: User pointer to a struct msg_slot_txn, the entries get their new sequence
+ *        numbers and the transaction its generation.
+ *
+ * Return: 0 on success, -EINVAL for a bad entry count or channel ID, -EMSGSIZE for an
+ * invalid message length, -EFAULT on a bad user pointer, -ENOMEM, or the errors of
+ * prepare_update(). Nothing is written unless 0 is returned.
+ */
+static long txn_write(struct message_slot *slot, struct msg_slot_txn __user *uarg) {
+    struct msg_slot_txn req;
+    struct msg_slot_txn_entry *entries = NULL;
+    struct message_update *updates = NULL;
+    struct message_payload *payload;
+    struct iov_iter from;
+    const char *msg;
+    char *data = NULL;
+    u32 prepared = 0;
+    long ret = 0;
+    u32 i;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (req.count == 0 || req.count > MSG_SLOT_TXN_MAX) {
+        return -EINVAL;
+    }
+
+    entries = kmalloc_array(req.count, sizeof(*entries), GFP_KERNEL);
+    updates = kmalloc_array(req.count, sizeof(*updates), GFP_KERNEL);
+    data = kmalloc_array(req.count, MSG_SLOT_INLINE_LEN, GFP_KERNEL);
+    if (!entries || !updates || !data) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    if (copy_from_user(entries, u64_to_user_ptr(req.entries), req.count * sizeof(*entries))) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    // Validate every entry before touching any channel
+    for (i = 0; i < req.count; i++) {
+        if (entries[i].channel_id == 0) {
+            ret = -EINVAL;
+            goto out;
+        }
+        if (!message_len_ok(entries[i].len)) {
+            ret = -EMSGSIZE;
+            goto out;
+        }
+    }
+
+    for (prepared = 0; prepared < req.count; prepared++) {
+        ret = import_ubuf(ITER_SOURCE, u64_to_user_ptr(entries[prepared].buf), entries[prepared].len,
+                          &from);
+        if (ret) {
+            goto out;
+        }
+        msg = copy_message_in(slot, &from, data + prepared * MSG_SLOT_INLINE_LEN, &payload);
+        if (IS_ERR(msg)) {
+            ret = PTR_ERR(msg);
+            goto out;
+        }
+        payload = pack_message(slot, msg, entries[prepared].len, payload);
+        ret = prepare_update(slot, entries[prepared].channel_id, msg, entries[prepared].len,
+                             payload, true, &updates[prepared]);
+        if (ret) {
+            goto out;
+        }
+    }
+
+    // set_broadcast() takes the transaction lock too, so the logs seen here stay put and
+    // no commit below asks for a payload half way through the transaction
+    mutex_lock(&slot->txn_lock);
+    for (i = 0; i < req.count; i++) {
+        if (!updates[i].payload && READ_ONCE(updates[i].channel->log)) {
+            ret = add_log_payload(slot, &updates[i]);
+            if (ret) {
+                mutex_unlock(&slot->txn_lock);
+                goto out;
+            }
+        }
+    }
+    write_seqcount_begin(&slot->txn_seq);
+    for (i = 0; i < req.count; i++) {
+        commit_update(slot, &updates[i], NULL, &entries[i].seq);
+    }
+    write_seqcount_end(&slot->txn_seq);
+    req.generation = raw_read_seqcount(&slot->txn_seq) >> 1;
+    mutex_unlock(&slot->txn_lock);
+
+    if (copy_to_user(u64_to_user_ptr(req.entries), entries, req.count * sizeof(*entries)) ||
+        copy_to_user(uarg, &req, sizeof(req))) {
+        ret = -EFAULT; // The transaction is committed, only the report back failed
+    }
+
+out:
+    for (i = 0; i < prepared; i++) {
+        finish_update(slot, &updates[i]);
+    }
+    kfree(data);
+    kfree(updates);
+    kfree(entries);
+    return ret;
+}
+
+
+/**
+ * txn_read - Reads several channels of a slot as one consistent snapshot.
+ *
+ * The channels are looked up and their messages copied under the slot's seqcount, and
+ * both are retried if a transaction committed meanwhile, so the snapshot never shows
+ * part of a transaction, not even one that created or replaced a channel.
+ * Transaction writers never wait for readers. Plain writes are not transactions, a
+ * snapshot is only consistent with respect to txn_write().
+ *
+ * @slot: The slot that holds the channels.
+ * @uarg: User pointer to a struct msg_slot_txn. Every entry gets its message copied,
+ *        its len and seq set (both 0 for a channel without a message), and the snapshot
+ *        gets the generation of the last transaction it includes.
+ *
+ * Return: 0 on success, -ENOSPC if some buffer is too small (its len is set to the
+ * length needed and the other entries are still filled), -EINVAL for a bad entry count
+ * or channel ID, -EFAULT on a bad user pointer, or -ENOMEM.
+ */
+static long txn_read(struct message_slot *slot, struct msg_slot_txn __user *uarg) {
+    struct msg_slot_txn req;
+    struct msg_slot_txn_entry *entries = NULL;
+    struct message_snapshot_entry *snap = NULL;
+    struct message_channel *channel;
+    spinlock_t *lock;
+    unsigned int gen;
+    long ret = 0;
+    int err;
+    u32 i;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (req.count == 0 || req.count > MSG_SLOT_TXN_MAX) {
+        return -EINVAL;
+    }
+
+    entries = kmalloc_array(req.count, sizeof(*entries), GFP_KERNEL);
+    snap = kcalloc(req.count, sizeof(*snap), GFP_KERNEL);
+    if (!entries || !snap) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    if (copy_from_user(entries, u64_to_user_ptr(req.entries), req.count * sizeof(*entries))) {
+        ret = -EFAULT;
+        goto out;
+    }
+    for (i = 0; i < req.count; i++) {
+        if (entries[i].channel_id == 0) {
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    do {
+        gen = read_seqcount_begin(&slot->txn_seq);
+        for (i = 0; i < req.count; i++) {
+            // Drop what an attempt that raced took. The channels are looked up again
+            // as a transaction may have created them or replaced them meanwhile.
+            release_copy(slot, &snap[i].copy);
+            snap[i].copy.len = 0;
+            snap[i].copy.seq = 0;
+            if (snap[i].channel) {
+                put_channel(snap[i].channel);
+            }
+            channel = snap[i].channel = find_channel(slot, entries[i].channel_id);
+            if (!channel) {
+                continue; // Never written, reads as empty
+            }
+            lock = channel_lock(slot, channel->channel_id);
+            spin_lock(lock);
+            copy_message(channel, &snap[i].copy);
+            spin_unlock(lock);
+        }
+    } while (read_seqcount_retry(&slot->txn_seq, gen));
+
+    for (i = 0; i < req.count; i++) {
+        if (snap[i].copy.len > entries[i].len) {
+            ret = -ENOSPC;
+        } else {
+            err = unpack_copy(slot, &snap[i].copy); // Outside the seqcount retry loop
+            if (err) {
+                ret = err;
+                goto out;
+            }
+            if (snap[i].copy.len &&
+                copy_to_user(u64_to_user_ptr(entries[i].buf), snap[i].copy.data, snap[i].copy.len)) {
+                ret = -EFAULT;
+                goto out;
+            }
+        }
+        entries[i].len = snap[i].copy.len;
+        entries[i].seq = snap[i].copy.seq;
+    }
+
+    req.generation = gen >> 1;
+    if (copy_to_user(u64_to_user_ptr(req.entries), entries, req.count * sizeof(*entries)) ||
+        copy_to_user(uarg, &req, sizeof(req))) {
+        ret = -EFAULT;
+    }
+
+out:
+    if (snap) {
+        for (i = 0; i < req.count; i++) {
+            release_copy(slot, &snap[i].copy);
+            if (snap[i].channel) {
+                put_channel(snap[i].channel);
+            }
+        }
+    }
+    kfree(snap);
+    kfree(entries);
+    return ret;
+}
+
+
+/**
+ * write_many - Writes one message to many channels of a slot, storing it once.
+ *
+ * The message is copied in and packed once into a payload that every channel takes a
+ * reference to, so a fan-out costs one copy of the message rather than one per channel.
+ * Payloads never change once written, so this is copy on write for free: a later write
+ * to one of the channels swaps that channel's pointer, the others keep sharing the old
+ * payload, freed with its last reference. Broadcast logs share the payload as well.
+ *
+ * @slot: The slot to write.
+ * @uarg: User pointer to a struct msg_slot_write_many, count is set to the number of
+ *        channels written.
+ *
+ * Return: 0 on success, -EINVAL for a bad count or a zero ID, -EMSGSIZE for an invalid
+ * length, -EFAULT on a bad user pointer, -ENOMEM, or the errors of prepare_update() for
+ * the first channel that could not be written.
+ */
+static long write_many(struct message_slot *slot, struct msg_slot_write_many __user *uarg) {
+    struct msg_slot_write_many req;
+    struct message_payload *payload;
+    struct message_update update;
+    struct iov_iter from;
+    const char *data;
+    u32 *ids;
+    u32 written = 0;
+    long ret = 0;
+    u32 i;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    if (req.count == 0 || req.count > MSG_SLOT_WRITE_MANY_MAX) {
+        return -EINVAL;
+    }
+    if (!message_len_ok(req.len)) {
+        return -EMSGSIZE;
+    }
+
+    ids = kvmalloc_array(req.count, sizeof(*ids), GFP_KERNEL);
+    if (!ids) {
+        return -ENOMEM;
+    }
+    if (copy_from_user(ids, u64_to_user_ptr(req.channel_ids), req.count * sizeof(*ids))) {
+        ret = -EFAULT;
+        goto out;
+    }
+    for (i = 0; i < req.count; i++) {
+        if (ids[i] == 0) {
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    // A payload even for a short message, so broadcast logs share it too
+    payload = alloc_payload(slot, NULL, req.len);
+    if (IS_ERR(payload)) {
+        ret = PTR_ERR(payload);
+        goto out;
+    }
+    ret = import_ubuf(ITER_SOURCE, u64_to_user_ptr(req.buf), req.len, &from);
+    if (!ret && copy_from_iter(payload->data, req.len, &from) != req.len) {
+        ret = -EFAULT;
+    }
+    if (ret) {
+        put_payload(slot, payload);
+        goto out;
+    }
+    data = payload->data;
+    payload = pack_message(slot, data, req.len, payload);
+
+    for (written = 0; written < req.count; written++) {
+        refcount_inc(&payload->refs); // Passed to the update
+        ret = prepare_update(slot, ids[written], data, req.len, payload, true, &update);
+        if (ret) {
+            break;
+        }
+        commit_update(slot, &update, NULL, NULL);
+        finish_update(slot, &update);
+        cond_resched();
+    }
+    put_payload(slot, payload);
+
+out:
+    kvfree(ids);
+    req.count = written;
+    if (copy_to_user(uarg, &req, sizeof(req))) {
+        ret = -EFAULT;
+    }
+    return ret;
+}
+
+
+// Size of the kernel bounce buffer of snapshot export and import
+#define SNAPSHOT_CHUNK (256 * 1024)
+
+/**
+ * export_slot - Serializes the messages of a slot into a user buffer.
+ *
+ * Records are built in a kernel chunk under rcu_read_lock(), each message pinned under
+ * its channel's lock and copied into the chunk after the lock is dropped, and the chunk
+ * is copied out in one go, so the export costs one user copy per chunk rather than per
+ * channel and no lock is held across the slot or a long memcpy.
+ * The stream is consistent per channel, not across the slot. Broadcast logs are not
+ * exported, only each channel's current message. A record too large for the chunk or
+ * stored compressed is copied out on its own, from its pinned payload once outside the
+ * RCU read section. Records always carry the message uncompressed. Every channel visited
+ * is referenced before its lock is taken, as a deletion or eviction running meanwhile
+ * frees the message of a channel whose last reference it drops without waiting for RCU.
+ *
+ * @slot: The slot to export.
+ * @uarg: User pointer to a struct msg_slot_snapshot, updated with cursor, flags,
+ *        produced length and record count.
+ *
+ * Return: 0 on success, -ENOSPC if buf cannot hold even the next record, -EFAULT on a
+ * bad user pointer, or -ENOMEM.
+ */
+static long export_slot(struct message_slot *slot, struct msg_slot_snapshot __user *uarg) {
+    struct msg_slot_snapshot req;
+    struct msg_slot_record *rec;
+    struct msg_slot_record large_rec;
+    struct message_payload **pinned = NULL;
+    struct message_channel **visited = NULL;
+    struct message_channel *channel;
+    struct message_copy large;
+    struct message_copy copy;
+    unsigned long index;
+    spinlock_t *lock;
+    size_t used = 0;
+    size_t space;
+    size_t n;
+    size_t size;
+    bool full = false;
+    bool end = false;
+    bool direct;
+    char *kbuf;
+    long ret = 0;
+    int err;
+    u64 count = 0;
+    unsigned int batch;
+    unsigned int npinned;
+    unsigned int nvisited;
+    unsigned int i;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+
+    kbuf = kvmalloc(min_t(u64, req.len, SNAPSHOT_CHUNK), GFP_KERNEL);
+    pinned = kmalloc_array(LIST_BATCH, sizeof(*pinned), GFP_KERNEL);
+    visited = kmalloc_array(LIST_BATCH, sizeof(*visited), GFP_KERNEL);
+    if (!kbuf || !pinned || !visited) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    large.payload = NULL;
+    while (!full && !end) {
+        space = min_t(u64, req.len - used, SNAPSHOT_CHUNK);
+        n = 0;
+        batch = 0;
+        npinned = 0;
+        nvisited = 0;
+        end = true;
+
+        if (req.cursor == UINT_MAX) {
+            break; // Nothing can follow the last possible ID
+        }
+
+        rcu_read_lock();
+        xa_for_each_start(&slot->channels, index, channel, (unsigned long)req.cursor + 1) {
+            // Keep RCU read sections short, resume from the cursor in a new one
+            if (batch++ == LIST_BATCH) {
+                end = false;
+                break;
+            }
+            if (!refcount_inc_not_zero(&channel->refs)) {
+                continue; // Being freed, as good as deleted
+            }
+            visited[nvisited++] = channel; // Dropped outside RCU, like the payloads
+            lock = channel_lock(slot, channel->channel_id);
+            spin_lock(lock);
+            size = channel->message_len ? MSG_SLOT_RECORD_SIZE(channel->message_len) : 0;
+            direct = size > SNAPSHOT_CHUNK || (channel->payload && channel->payload->packed_len);
+            if (direct || n + size > space) {
+                if (n + size > req.len - used) {
+                    full = true; // Only the user buffer running out stops the export
+                } else if (direct) {
+                    // Copied out below, after the chunk and outside the RCU read section
+                    large_rec.channel_id = channel->channel_id;
+                    large_rec.message_len = channel->message_len;
+                    copy_message(channel, &large);
+                }
+                spin_unlock(lock);
+                end = false;
+                break;
+            }
+            copy_message(channel, &copy);
+            spin_unlock(lock);
+            if (size) {
+                rec = (struct msg_slot_record *)(kbuf + n);
+                rec->channel_id = channel->channel_id;
+                rec->message_len = copy.len;
+                memcpy(rec + 1, copy.data, copy.len);
+                memset((char *)(rec + 1) + rec->message_len, 0,
+                       size - sizeof(*rec) - rec->message_len);
+                n += size;
+                count++;
+            }
+            if (copy.payload) {
+                pinned[npinned++] = copy.payload; // Freeing it may sleep, dropped outside RCU
+            }
+            req.cursor = channel->channel_id; // Empty channels are covered too
+        }
+        rcu_read_unlock();
+        for (i = 0; i < npinned; i++) {
+            put_payload(slot, pinned[i]);
+        }
+        for (i = 0; i < nvisited; i++) {
+            put_channel(visited[i]);
+        }
+
+        if (n && copy_to_user(u64_to_user_ptr(req.buf) + used, kbuf, n)) {
+            ret = -EFAULT;
+            goto out;
+        }
+        used += n;
+
+        if (large.payload) {
+            size = MSG_SLOT_RECORD_SIZE(large.len);
+            err = unpack_copy(slot, &large);
+            if (!err &&
+                (copy_to_user(u64_to_user_ptr(req.buf) + used, &large_rec, sizeof(large_rec)) ||
+                 copy_to_user(u64_to_user_ptr(req.buf) + used + sizeof(large_rec), large.data, large.len) ||
+                 clear_user(u64_to_user_ptr(req.buf) + used + sizeof(large_rec) + large.len,
+                            size - sizeof(large_rec) - large.len))) {
+                err = -EFAULT;
+            }
+            release_copy(slot, &large);
+            if (err) {
+                ret = err;
+                goto out;
+            }
+            used += size;
+            count++;
+            req.cursor = large_rec.channel_id;
+        }
+        cond_resched();
+    }
+
+    if (full && used == 0) {
+        ret = -ENOSPC; // The next record does not fit at all
+        goto out;
+    }
+
+    req.flags = end ? MSG_SLOT_SNAPSHOT_END : 0;
+    req.len = used;
+    req.count = count;
+    if (copy_to_user(uarg, &req, sizeof(req))) {
+        ret = -EFAULT;
+    }
+out:
+    kfree(visited);
+    kfree(pinned);
+    kvfree(kbuf);
+    return ret;
+}
+
+
+// Imports a record that does not fit the bounce buffer, its message is at data
+static int import_large_record(struct message_slot *slot, const struct msg_slot_record *rec,
+                               const char __user *data) {
+    struct message_payload *payload;
+    struct iov_iter from;
+    const char *msg;
+    int ret;
+
+    ret = import_ubuf(ITER_SOURCE, (void __user *)data, rec->message_len, &from);
+    if (ret) {
+        return ret;
+    }
+    msg = copy_message_in(slot, &from, NULL, &payload); // Always too long to be inline
+    if (IS_ERR(msg)) {
+        return PTR_ERR(msg);
+    }
+    return store_message(slot, rec->channel_id, msg, rec->message_len, payload, NULL, NULL);
+}
+
+
+/**
+ * import_slot - Loads a record stream produced by export_slot() into a slot.
+ *
+ * The stream is copied in by chunks and every record is written to its channel as by
+ * device_write(), creating the channel if needed. A record cut off by the end of buf is
+ * not consumed, so a caller streaming a file can pass it again at the start of the next
+ * call. A record too large for the chunk is copied straight into its payload.
+ *
+ * @slot: The slot to load into.
+ * @uarg: User pointer to a struct msg_slot_snapshot, len and count are set to what was
+ *        consumed even when an error stops the import.
+ *
+ * Return: 0 on success, -EINVAL for a malformed record, -EFAULT on a bad user pointer,
+ * -ENOMEM, or the errors of store_message().
+ */
+static long import_slot(struct message_slot *slot, struct msg_slot_snapshot __user *uarg) {
+    struct msg_slot_snapshot req;
+    struct msg_slot_record *rec;
+    size_t used = 0;
+    size_t chunk;
+    size_t pos;
+    size_t size;
+    char *kbuf;
+    u64 count = 0;
+    long ret = 0;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+
+    kbuf = kvmalloc(min_t(u64, req.len, SNAPSHOT_CHUNK), GFP_KERNEL);
+    if (!kbuf) {
+        return -ENOMEM;
+    }
+
+    while (!ret && used < req.len) {
+        chunk = min_t(u64, req.len - used, SNAPSHOT_CHUNK);
+        if (copy_from_user(kbuf, u64_to_user_ptr(req.buf) + used, chunk)) {
+            ret = -EFAULT;
+            break;
+        }
+
+        // Write every complete record of the chunk
+        for (pos = 0; pos + sizeof(*rec) <= chunk; pos += size) {
+            rec = (struct msg_slot_record *)(kbuf + pos);
+            if (rec->channel_id == 0 || !message_len_ok(rec->message_len)) {
+                ret = -EINVAL;
+                break;
+            }
+            size = MSG_SLOT_RECORD_SIZE(rec->message_len);
+            if (pos + size > chunk) {
+                if (pos == 0 && size > SNAPSHOT_CHUNK && size <= req.len - used) {
+                    ret = import_large_record(slot, rec, u64_to_user_ptr(req.buf) + used + sizeof(*rec));
+                    if (!ret) {
+                        pos = size;
+                        count++;
+                    }
+                }
+                break; // Cut off, the next chunk starts with it
+            }
+            ret = store_message(slot, rec->channel_id, (char *)(rec + 1), rec->message_len,
+                                NULL, NULL, NULL);
+            if (ret) {
+                break;
+            }
+            count++;
+        }
+
+        if (pos == 0) {
+            break; // Only a partial record is left
+        }
+        used += pos;
+        cond_resched();
+    }
+    kvfree(kbuf);
+
+    req.len = used;
+    req.count = count;
+    if (copy_to_user(uarg, &req, sizeof(req))) {
+        return -EFAULT;
+    }
+    return ret;
+}
+
+
+/**
+ * copy_channel_ids - Copies in and validates the channel IDs of a watch request.
+ *
+ * Return: A kmalloc'ed array of count IDs, ERR_PTR(-EINVAL) for a bad count or a zero
+ * ID, ERR_PTR(-EFAULT) or ERR_PTR(-ENOMEM).
+ */
+static u32 *copy_channel_ids(u64 uptr, u32 count) {
+    u32 *ids;
+    u32 i;
+
+    if (count == 0 || count > MSG_SLOT_WATCH_MAX) {
+        return ERR_PTR(-EINVAL);
+    }
+    ids = kmalloc_array(count, sizeof(*ids), GFP_KERNEL);
+    if (!ids) {
+        return ERR_PTR(-ENOMEM);
+    }
+    if (copy_from_user(ids, u64_to_user_ptr(uptr), count * sizeof(*ids))) {
+        kfree(ids);
+        return ERR_PTR(-EFAULT);
+    }
+    for (i = 0; i < count; i++) {
+        if (ids[i] == 0) {
+            kfree(ids);
+            return ERR_PTR(-EINVAL);
+        }
+    }
+    return ids;
+}
+
+
+// Finds the watch of an owner and eventfd (NULL for a queue) on a channel, called with
+// the slot's watch_lock held
+static struct message_watch *find_watch(struct message_watch_list *list, const void *owner,
+                                        struct eventfd_ctx *eventfd) {
+    struct message_watch *watch;
+
+    list_for_each_entry(watch, &list->watches, node) {
+        if (watch->owner == owner && watch->eventfd == eventfd) {
+            return watch;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * add_watch - Makes an eventfd or a queue watch one channel.
+ *
+ * Called with the slot's watch_lock held.
+ *
+ * @slot: The slot of the channel.
+ * @channel_id: The channel to watch.
+ * @owner: The file (eventfd watches) or queue the watch belongs to.
+ * @owner_watches: The owner's list of watches.
+ * @efile: The eventfd's file, or NULL for a queue watch.
+ * @queue: The queue to report to, or NULL for an eventfd watch.
+ *
+ * Return: 0 on success, also if the watch already exists, or -ENOMEM.
+ */
+static int add_watch(struct message_slot *slot, unsigned int channel_id, const void *owner,
+                     struct list_head *owner_watches, struct file *efile, struct message_queue *queue) {
+    struct message_watch_list *list = xa_load(&slot->watches, channel_id);
+    struct message_watch *watch;
+    struct eventfd_ctx *eventfd = efile ? eventfd_ctx_fileget(efile) : NULL;
+    int ret;
+
+    if (list && find_watch(list, owner, eventfd)) {
+        if (eventfd) {
+            eventfd_ctx_put(eventfd);
+        }
+        return 0;
+    }
+
+    watch = kmalloc(sizeof(*watch), GFP_KERNEL_ACCOUNT);
+    if (!watch) {
+        if (eventfd) {
+            eventfd_ctx_put(eventfd);
+        }
+        return -ENOMEM;
+    }
+
+    // The first watch of a channel publishes its list, writers find it from then on
+    if (!list) {
+        list = kmalloc(sizeof(*list), GFP_KERNEL_ACCOUNT);
+        ret = list ? 0 : -ENOMEM;
+        if (list) {
+            INIT_LIST_HEAD(&list->watches);
+            ret = xa_err(xa_store(&slot->watches, channel_id, list, GFP_KERNEL_ACCOUNT));
+        }
+        if (ret) {
+            kfree(list); // Not stored, no writer can see it
+            kfree(watch);
+            if (eventfd) {
+                eventfd_ctx_put(eventfd);
+            }
+            return ret;
+        }
+    }
+
+    watch->owner = owner;
+    watch->channel_id = channel_id;
+    watch->eventfd = eventfd;
+    watch->queue = queue;
+    INIT_LIST_HEAD(&watch->pending_node);
+    watch->removed = false;
+    list_add_tail_rcu(&watch->node, &list->watches);
+    list_add_tail(&watch->owner_node, owner_watches);
+    return 0;
+}
+
+
+/**
+ * watch_eventfd - Signals an eventfd on every write to any of a set of channels.
+ *
+ * Each channel gets a watch holding its own reference of the eventfd, so the caller may
+ * close the eventfd's descriptor once bound. Channels need not exist yet, the watch is
+ * keyed by ID and also covers channels created, deleted or evicted later. Watching a
+ * channel again with the same eventfd through the same file is a no-op.
+ *
+ * @mfile: The file the watches belong to, they are removed when it is released.
+ * @uarg: User pointer to a struct msg_slot_eventfd.
+ *
+ * Return: 0 on success, -EINVAL for a bad count or channel ID, -EBADF if fd is not an
+ * eventfd, -EFAULT on a bad user pointer, or -ENOMEM. On failure the channels handled
+ * before the failing one stay watched.
+ */
+static long watch_eventfd(struct message_file *mfile, struct msg_slot_eventfd __user *uarg) {
+    struct message_slot *slot = mfile->slot;
+    struct msg_slot_eventfd req;
+    struct file *efile;
+    u32 *ids;
+    long ret = 0;
+    u32 i;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    ids = copy_channel_ids(req.channel_ids, req.count);
+    if (IS_ERR(ids)) {
+        return PTR_ERR(ids);
+    }
+    efile = eventfd_fget(req.fd);
+    if (IS_ERR(efile)) {
+        kfree(ids);
+        return PTR_ERR(efile);
+    }
+
+    mutex_lock(&slot->watch_lock);
+    for (i = 0; i < req.count && !ret; i++) {
+        ret = add_watch(slot, ids[i], mfile, &mfile->watches, efile, NULL);
+    }
+    mutex_unlock(&slot->watch_lock);
+
+    fput(efile);
+    kfree(ids);
+    return ret;
+}
+
+
+/**
+ * unwatch_eventfd - Removes the watches watch_eventfd() made with the same file and eventfd.
+ *
+ * Channels that are not watched this way are skipped.
+ *
+ * Return: 0 on success, -EINVAL for a bad count or channel ID, -EBADF if fd is not an
+ * eventfd, -EFAULT on a bad user pointer, or -ENOMEM.
+ */
+static long unwatch_eventfd(struct message_file *mfile, struct msg_slot_eventfd __user *uarg) {
+    struct message_slot *slot = mfile->slot;
+    struct msg_slot_eventfd req;
+    struct message_watch_list *list;
+    struct message_watch *watch;
+    struct eventfd_ctx *eventfd;
+    u32 *ids;
+    u32 i;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    ids = copy_channel_ids(req.channel_ids, req.count);
+    if (IS_ERR(ids)) {
+        return PTR_ERR(ids);
+    }
+    eventfd = eventfd_ctx_fdget(req.fd);
+    if (IS_ERR(eventfd)) {
+        kfree(ids);
+        return PTR_ERR(eventfd);
+    }
+
+    mutex_lock(&slot->watch_lock);
+    for (i = 0; i < req.count; i++) {
+        list = xa_load(&slot->watches, ids[i]);
+        watch = list ? find_watch(list, mfile, eventfd) : NULL;
+        if (watch) {
+            remove_watch(slot, watch);
+        }
+    }
+    mutex_unlock(&slot->watch_lock);
+
+    eventfd_ctx_put(eventfd);
+    kfree(ids);
+    return 0;
+}
+
+
+// RCU callback of remove_watch(), no writer walks the watch any more
+static void free_watch(struct rcu_head *rcu) {
+    struct message_watch *watch = container_of(rcu, struct message_watch, rcu);
+
+    if (watch->eventfd) {
+        eventfd_ctx_put(watch->eventfd);
+    }
+    kfree(watch);
+}
+
+
+// Unlinks a watch and frees it after an RCU grace period, called with the slot's watch_lock held
+static void remove_watch(struct message_slot *slot, struct message_watch *watch) {
+    struct message_watch_list *list = xa_load(&slot->watches, watch->channel_id);
+
+    list_del_rcu(&watch->node);
+    list_del(&watch->owner_node);
+    if (watch->queue) {
+        // A writer that still sees the watch must not queue it again
+        spin_lock(&watch->queue->lock);
+        list_del_init(&watch->pending_node);
+        watch->removed = true;
+        spin_unlock(&watch->queue->lock);
+    }
+    if (list_empty(&list->watches)) {
+        xa_erase(&slot->watches, watch->channel_id);
+        kfree_rcu(list, rcu);
+    }
+    call_rcu(&watch->rcu, free_watch);
+}
+
+
+/**
+ * notify_watchers - Tells the eventfds and queues watching a channel about a write to it.
+ *
+ * Runs on every write without taking a lock, a channel nobody watches costs one xarray
+ * lookup. eventfd_signal() only takes the eventfd's own spinlock, so many channels can
+ * share one eventfd and the reader learns that something changed, not what. A queue
+ * also learns which channel, see queue_change().
+ */
+static void notify_watchers(struct message_slot *slot, unsigned int channel_id) {
+    struct message_watch_list *list;
+    struct message_watch *watch;
+
+    rcu_read_lock();
+    list = xa_load(&slot->watches, channel_id);
+    if (list) {
+        list_for_each_entry_rcu(watch, &list->watches, node) {
+            if (watch->eventfd) {
+                eventfd_signal(watch->eventfd);
+            } else {
+                queue_change(watch);
+            }
+        }
+    }
+    rcu_read_unlock();
+}
+
+
+/**
+ * subscribe - Creates a notification fd or adds channels to one.
+ *
+ * A notification fd is backed by a struct message_queue whose watches sit in the same
+ * per channel lists as the eventfd watches. A write queues the watch of its channel
+ * unless it is already queued, so pending changes are coalesced per channel and the
+ * queue never holds more entries than the channels it watches.
+ *
+ * @mfile: The file the request came from, its slot is the one watched.
+ * @uarg: User pointer to a struct msg_slot_subscribe.
+ *
+ * Return: The new notification fd, 0 when adding to an existing one, -EINVAL for a bad
+ * count or channel ID or an fd that is not a notification fd of this slot, -EBADF for
+ * an fd that is not open, -EFAULT on a bad user pointer, -ENOMEM, or the errors of
+ * anon_inode_getfd(). Adding stops at the first failing channel, a new fd is not
+ * created on failure.
+ */
+static long subscribe(struct message_file *mfile, struct msg_slot_subscribe __user *uarg) {
+    struct message_slot *slot = mfile->slot;
+    struct msg_slot_subscribe req;
+    struct message_queue *queue;
+    struct file *qfile = NULL;
+    u32 *ids;
+    long ret = 0;
+    u32 i;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    ids = copy_channel_ids(req.channel_ids, req.count);
+    if (IS_ERR(ids)) {
+        return PTR_ERR(ids);
+    }
+
+    if (req.fd >= 0) {
+        queue = get_queue(slot, req.fd, &qfile);
+    } else {
+        queue = kmalloc(sizeof(*queue), GFP_KERNEL_ACCOUNT);
+        if (queue) {
+            queue->slot = slot;
+            spin_lock_init(&queue->lock);
+            INIT_LIST_HEAD(&queue->pending);
+            init_waitqueue_head(&queue->wait);
+            INIT_LIST_HEAD(&queue->watches);
+        } else {
+            queue = ERR_PTR(-ENOMEM);
+        }
+    }
+    if (IS_ERR(queue)) {
+        kfree(ids);
+        return PTR_ERR(queue);
+    }
+
+    mutex_lock(&slot->watch_lock);
+    for (i = 0; i < req.count && !ret; i++) {
+        ret = add_watch(slot, ids[i], queue, &queue->watches, NULL, queue);
+    }
+    mutex_unlock(&slot->watch_lock);
+    kfree(ids);
+
+    if (qfile) {
+        fput(qfile);
+        return ret;
+    }
+
+    // Installing the fd must come last, user space may close it right away
+    if (!ret) {
+        ret = anon_inode_getfd("[message_slot_notify]", &queue_fops, queue, O_RDONLY | O_CLOEXEC);
+        if (ret >= 0) {
+            return ret;
+        }
+    }
+    mutex_lock(&slot->watch_lock);
+    release_queue_watches(queue);
+    mutex_unlock(&slot->watch_lock);
+    kfree_rcu(queue, rcu);
+    return ret;
+}
+
+
+/**
+ * unsubscribe - Removes channels from a notification fd.
+ *
+ * Channels the fd does not watch are skipped, changes of the removed channels that were
+ * not read yet are dropped.
+ *
+ * Return: 0 on success, -EINVAL for a bad count or channel ID or an fd that is not a
+ * notification fd of this slot, -EBADF for an fd that is not open, -EFAULT on a bad user
+ * pointer, or -ENOMEM.
+ */
+static long unsubscribe(struct message_file *mfile, struct msg_slot_subscribe __user *uarg) {
+    struct message_slot *slot = mfile->slot;
+    struct msg_slot_subscribe req;
+    struct message_watch_list *list;
+    struct message_watch *watch;
+    struct message_queue *queue;
+    struct file *qfile;
+    u32 *ids;
+    u32 i;
+
+    if (copy_from_user(&req, uarg, sizeof(req))) {
+        return -EFAULT;
+    }
+    ids = copy_channel_ids(req.channel_ids, req.count);
+    if (IS_ERR(ids)) {
+        return PTR_ERR(ids);
+    }
+    queue = get_queue(slot, req.fd, &qfile);
+    if (IS_ERR(queue)) {
+        kfree(ids);
+        return PTR_ERR(queue);
+    }
+
+    mutex_lock(&slot->watch_lock);
+    for (i = 0; i < req.count; i++) {
+        list = xa_load(&slot->watches, ids[i]);
+        watch = list ? find_watch(list, queue, NULL) : NULL;
+        if (watch) {
+            remove_watch(slot, watch);
+        }
+    }
+    mutex_unlock(&slot->watch_lock);
+
+    fput(qfile);
+    kfree(ids);
+    return 0;
+}
+
+
+// Resolves a notification fd of a slot, the queue stays valid until fput(*qfile)
+static struct message_queue *get_queue(struct message_slot *slot, int fd, struct file **qfile) {
+    struct message_queue *queue;
+
+    *qfile = fget(fd);
+    if (!*qfile) {
+        return ERR_PTR(-EBADF);
+    }
+    queue = (*qfile)->private_data;
+    if ((*qfile)->f_op != &queue_fops || queue->slot != slot) {
+        fput(*qfile);
+        return ERR_PTR(-EINVAL);
+    }
+    return queue;
+}
+
+
+// Queues the change of a watched channel unless it is already pending, runs under RCU.
+// The check is made under the queue's lock so it cannot miss a reader taking the entry.
+static void queue_change(struct message_watch *watch) {
+    struct message_queue *queue = watch->queue;
+
+    spin_lock(&queue->lock);
+    if (!watch->removed && list_empty(&watch->pending_node)) {
+        list_add_tail(&watch->pending_node, &queue->pending);
+    }
+    spin_unlock(&queue->lock);
+    wake_up_interruptible(&queue->wait);
+}
+
+
+// Channel IDs moved out of a queue per lock hold
+#define QUEUE_BATCH 64
+
+/**
+ * queue_read - Reads the IDs of the channels that changed since the last read.
+ *
+ * IDs are reported oldest change first and a channel is queued again by its next write
+ * once it was reported. Blocks until some watched channel changes unless the file is
+ * non-blocking.
+ *
+ * Return: The number of bytes read, a multiple of sizeof(__u32), -EINVAL if the buffer
+ * cannot hold one ID, -EAGAIN if nothing changed on a non-blocking file,
+ * -ERESTARTSYS when interrupted, or -EFAULT (the IDs taken by that read are lost).
+ */
+static ssize_t queue_read(struct file *file, char __user *buf, size_t count, loff_t *f_pos) {
+    struct message_queue *queue = file->private_data;
+    struct message_watch *watch;
+    u32 ids[QUEUE_BATCH];
+    size_t max = count / sizeof(u32);
+    size_t done = 0;
+    unsigned int n;
+    int ret;
+
+    if (max == 0) {
+        return -EINVAL;
+    }
+
+    while (done == 0) {
+        if (list_empty_careful(&queue->pending)) {
+            if (file->f_flags & O_NONBLOCK) {
+                return -EAGAIN;
+            }
+            ret = wait_event_interruptible(queue->wait, !list_empty_careful(&queue->pending));
+            if (ret) {
+                return ret;
+            }
+        }
+
+        // Another reader may empty the queue first, then wait again
+        do {
+            n = 0;
+            spin_lock(&queue->lock);
+            while (n < QUEUE_BATCH && done + n < max && !list_empty(&queue->pending)) {
+                watch = list_first_entry(&queue->pending, struct message_watch, pending_node);
+                list_del_init(&watch->pending_node);
+                ids[n++] = watch->channel_id;
+            }
+            spin_unlock(&queue->lock);
+
+            if (n && copy_to_user(buf + done * sizeof(u32), ids, n * sizeof(u32))) {
+                return -EFAULT;
+            }
+            done += n;
+        } while (n == QUEUE_BATCH && done < max);
+    }
+
+    return done * sizeof(u32);
+}
+
+
+static __poll_t queue_poll(struct file *file, poll_table *wait) {
+    struct message_queue *queue = file->private_data;
+
+    poll_wait(file, &queue->wait, wait);
+    return list_empty_careful(&queue->pending) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+
+// Removes every watch of a queue, called with the slot's watch_lock held
+static void release_queue_watches(struct message_queue *queue) {
+    struct message_watch *watch;
+    struct message_watch *tmp;
+
+    list_for_each_entry_safe(watch, tmp, &queue->watches, owner_node) {
+        remove_watch(queue->slot, watch);
+    }
+}
+
+
+static int queue_release(struct inode *inode, struct file *file) {
+    struct message_queue *queue = file->private_data;
+
+    mutex_lock(&queue->slot->watch_lock);
+    release_queue_watches(queue);
+    mutex_unlock(&queue->slot->watch_lock);
+
+    // Writers that found a watch before it was unlinked may still look at the queue
+    kfree_rcu(queue, rcu);
+    return 0;
+}
+
+
+/**
+ * report_error - Counts a failure and logs a rate limited summary of its kind.
+ *
+ * The counter increment touches only this CPU's copy. The summary check reads one shared
+ * word that changes at most once per ERROR_REPORT_INTERVAL, and only the CPU that wins
+ * the cmpxchg on it prints, so concurrent failures neither bounce a cache line nor queue
+ * on the console.
+ *
+ * @error: The kind of failure.
+ * @minor: The minor of the slot it happened on, reported in the summary.
+ */
+static void report_error(enum message_slot_error error, int minor) {
+    unsigned long next = READ_ONCE(error_report_at[error]);
+
+    this_cpu_inc(error_counts[error]);
+
+    if (time_before(jiffies, next) ||
+        cmpxchg(&error_report_at[error], next, jiffies + ERROR_REPORT_INTERVAL) != next) {
+        return;
+    }
+    printk(KERN_WARNING "message_slot: %s on minor %d, %lu since load\n",
+           error_names[error], minor, error_total(error));
+}
+
+
+// Sums the per CPU copies of a failure counter
+static unsigned long error_total(enum message_slot_error error) {
+    unsigned long total = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        total += per_cpu(error_counts, cpu)[error];
+    }
+    return total;
+}
+
+
+/**
+ * @brief Writes a message to the selected channel for the message slot device.
+ *
+ * This function writes a non-empty message of up to max_message_len bytes from the user's buffer
+ * to the channel previously selected by an IOCTL command. It ensures the message
+ * does not exceed the maximum allowed length and that a channel has been set for
+ * the file descriptor. The first write to a channel allocates it. On a broadcast
+ * channel the message is also appended to the channel's log.
+ *
+ * @param iocb The I/O control block, iocb->ki_filp is the open file whose private data
+ *        holds the channel ID selected by the IOCTL command. The position is ignored,
+ *        as the message slot channels do not support seeking.
+ * @param from Source of the message: a user buffer for write(), pipe pages for
+ *        splice(). The message can contain any sequence of bytes and is not
+ *        necessarily a C string. Its length must be greater than 0 and less than or
+ *        equal to max_message_len, a splice moves one message of at most the pipe's
+ *        size per call, see device_splice_write().
+ *
+ * @return On success, returns the number of bytes written. On error, returns -1,
+ *         with the expectation that errno is set to EINVAL if no channel has been
+ *         set or the message length is invalid, and to EMSGSIZE if the message length
+ *         exceeds max_message_len. Creating the channel fails with ENOSPC past the channel
+ *         limit, EDQUOT past the slot's memory quota and ENOMEM when out of memory.
+ *         A user buffer that cannot be read sets errno to EFAULT.
+ */
+static ssize_t device_write(struct kiocb *iocb, struct iov_iter *from) {
+    struct message_file *mfile = iocb->ki_filp->private_data;
+    size_t count = iov_iter_count(from);
+    struct message_payload *payload;
+    char kbuf[MSG_SLOT_INLINE_LEN];
+    const char *data;
+    int ret;
+
+    // Ensure a channel has been selected for the file descriptor
+    if (!mfile->channel_id) {
+
+        return -EINVAL; // Channel not set
+        }
+
+    // Validate the message length
+    if (!message_len_ok(count)) {
+    
+        return -EMSGSIZE; // Invalid message length
+        }
+
+    // Copy the new message from user space before touching the channel, so a faulting
+    // user buffer neither holds the channel's lock nor leaves a half written message
+    data = copy_message_in(mfile->slot, from, kbuf, &payload);
+    if (IS_ERR(data)) {
+        return PTR_ERR(data); // Failed to copy message from user space
+        }
+
+    // Store it in the selected channel, allocating the channel on its first write
+    ret = store_message(mfile->slot, mfile->channel_id, data, count, payload, NULL, NULL);
+    if (ret) {
+        return ret; // Channel limit, quota or memory allocation failure
+        }
+
+    return count; // Successfully written, return the number of bytes written
+    }
+
+
+/**
+ * device_splice_write - Moves one message from a pipe into the selected channel.
+ *
+ * iter_file_splice_write() passes the pipe's buffers to device_write() a batch at a time,
+ * and each batch replaces the message the previous one stored. A message therefore has
+ * to be in the pipe as a whole, which bounds it by the pipe's size (64 KiB unless raised
+ * with F_SETPIPE_SZ). A splice longer than the pipe can hold, and one flagged with
+ * SPLICE_F_MORE, would be split, so it is refused instead of silently keeping only its
+ * last part. sendfile() sets SPLICE_F_MORE on every chunk but the last, so a sendfile()
+ * of a message longer than its internal pipe fails too.
+ *
+ * Return: As iter_file_splice_write(), or -EMSGSIZE for a splice that cannot carry the
+ * whole message in one batch.
+ */
+static ssize_t device_splice_write(struct pipe_inode_info *pipe, struct file *out, loff_t *ppos,
+                                   size_t len, unsigned int flags) {
+    if ((flags & SPLICE_F_MORE) || len > ((size_t)pipe->max_usage << PAGE_SHIFT)) {
+        return -EMSGSIZE;
+    }
+    return iter_file_splice_write(pipe, out, ppos, len, flags);
+}
+
+
+/**
+ * @brief Reads the last message written to the selected channel into the user's buffer.
+ *
+ * On a broadcast channel each read instead returns the next logged message this file
+ * has not read yet, see read_broadcast(). A file in MSG_SLOT_READ_STREAM mode reads the
+ * message in parts, see read_stream().
+ *
+ * @param iocb The I/O control block, iocb->ki_filp is the open file whose private data
+ *        holds the currently selected channel ID. The position is ignored unless the
+ *        file is in stream mode, where it is the offset in the message.
+ * @param to Destination of the message: the user's buffer for read(), pipe pages for
+ *        splice(). Its size must hold the whole message unless the file is in stream mode.
+ *
+ * @return The number of bytes read on success. Returns -1 on error, with the expectation
+ *         that errno is set to EINVAL if no channel has been set, EWOULDBLOCK if no message
+ *         exists on the channel (including a channel that was never written, which is not
+ *         allocated by the read), ENOSPC if the user's buffer is too small, or another appropriate
+ *         value for different errors.
+ */
+static ssize_t device_read(struct kiocb *iocb, struct iov_iter *to) {
+    struct message_file *mfile = iocb->ki_filp->private_data;
+    struct message_channel *channel;
+    struct message_copy copy;
+    spinlock_t *lock;
+    ssize_t ret;
+
+    // Ensure a channel has been selected
+    if (!mfile->channel_id) {
+        return -1; // Channel not set, implying errno should be set to EINVAL
+    }
+
+    // Retrieve the selected channel, a channel that was never written does not exist
+    channel = find_channel(mfile->slot, mfile->channel_id);
+    if (!channel) {
+        return -EWOULDBLOCK; // No message exists, implying errno should be set to EWOULDBLOCK
+    }
+
+    touch_channel(channel);
+
+    // Take a consistent copy of the message, the user copy happens without the lock
+    lock = channel_lock(mfile->slot, channel->channel_id);
+    spin_lock(lock);
+    if (channel->log) {
+        ret = read_broadcast(mfile, channel, iocb, to); // Drops the lock
+        put_channel(channel);
+        return ret;
+    }
+    copy_message(channel, &copy);
+    spin_unlock(lock);
+    put_channel(channel);
+
+    // Check if a message exists in the channel
+    if (copy.len == 0) {
+        ret = -EWOULDBLOCK; // No message exists, implying errno should be set to EWOULDBLOCK
+    }
+
+    // Ensure the user's buffer is large enough to hold the message, unless it is streamed
+    else if (!READ_ONCE(mfile->stream) && iov_iter_count(to) < copy.len) {
+        ret = -ENOSPC; // Buffer too small, implying errno should be set to ENOSPC
+    } else {
+        // A compressed message is decompressed outside the channel's lock, once per file
+        ret = unpack_cached(mfile, &copy);
+        if (ret) {
+            // Not enough memory to decompress the message
+        }
+
+        // In stream mode continue where the file left off, from the start of a new message
+        else if (READ_ONCE(mfile->stream)) {
+            if (copy.seq != mfile->stream_seq) {
+                mfile->stream_seq = copy.seq;
+                iocb->ki_pos = 0;
+            }
+            ret = read_stream(copy.data, copy.len, iocb, to);
+        }
+
+        // Copy the message to the user's buffer
+        else if (copy_to_iter(copy.data, copy.len, to) != copy.len) {
+            ret = -1; // Failed to copy, handle as appropriate, generally implies an error
+        } else {
+            ret = copy.len; // Return the number of bytes read
+        }
     }
 
-    return channel->message_len; // Return the number of bytes read
+    // Only a stream read that has not reached the end of the message comes back for more
+    release_cached(mfile, &copy, !READ_ONCE(mfile->stream) || ret < 0 || iocb->ki_pos >= copy.len);
+    return ret;
 }
 
 
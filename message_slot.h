@@ -1,23 +1,511 @@
 #ifndef MESSAGE_SLOT_H
 #define MESSAGE_SLOT_H
 
-#define MAJOR_NUM 235
-#define MSG_SLOT_CHANNEL _IOW(MAJOR_NUM, 0, unsigned int)
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+// The ioctl type is the major number the device used to be registered with,
+// kept so the command numbers stay the same now that the major is dynamic.
+#define MSG_SLOT_IOC_MAGIC 235
+#define MSG_SLOT_CHANNEL _IOW(MSG_SLOT_IOC_MAGIC, 0, unsigned int)
+#define MSG_SLOT_LIST _IOWR(MSG_SLOT_IOC_MAGIC, 1, struct msg_slot_list)
+#define MSG_SLOT_DELETE _IOW(MSG_SLOT_IOC_MAGIC, 2, unsigned int)
+#define MSG_SLOT_SET_TTL _IOW(MSG_SLOT_IOC_MAGIC, 3, unsigned int)
+#define MSG_SLOT_STATS _IOR(MSG_SLOT_IOC_MAGIC, 4, struct msg_slot_stats)
+// Setting the quota requires CAP_SYS_ADMIN.
+#define MSG_SLOT_SET_QUOTA _IOW(MSG_SLOT_IOC_MAGIC, 5, __u64)
+#define MSG_SLOT_SET_NUMA_NODE _IOW(MSG_SLOT_IOC_MAGIC, 6, int)
+#define MSG_SLOT_SET_BROADCAST _IOW(MSG_SLOT_IOC_MAGIC, 7, struct msg_slot_broadcast)
+#define MSG_SLOT_READ_IF_NEWER _IOWR(MSG_SLOT_IOC_MAGIC, 8, struct msg_slot_read)
+#define MSG_SLOT_CAS _IOWR(MSG_SLOT_IOC_MAGIC, 9, struct msg_slot_cas)
+#define MSG_SLOT_TXN_WRITE _IOWR(MSG_SLOT_IOC_MAGIC, 10, struct msg_slot_txn)
+#define MSG_SLOT_TXN_READ _IOWR(MSG_SLOT_IOC_MAGIC, 11, struct msg_slot_txn)
+#define MSG_SLOT_EXPORT _IOWR(MSG_SLOT_IOC_MAGIC, 12, struct msg_slot_snapshot)
+#define MSG_SLOT_IMPORT _IOWR(MSG_SLOT_IOC_MAGIC, 13, struct msg_slot_snapshot)
+#define MSG_SLOT_WATCH_EVENTFD _IOW(MSG_SLOT_IOC_MAGIC, 14, struct msg_slot_eventfd)
+#define MSG_SLOT_UNWATCH_EVENTFD _IOW(MSG_SLOT_IOC_MAGIC, 15, struct msg_slot_eventfd)
+#define MSG_SLOT_SUBSCRIBE _IOW(MSG_SLOT_IOC_MAGIC, 16, struct msg_slot_subscribe)
+#define MSG_SLOT_UNSUBSCRIBE _IOW(MSG_SLOT_IOC_MAGIC, 17, struct msg_slot_subscribe)
+// Setting the channel limits requires CAP_SYS_ADMIN.
+#define MSG_SLOT_SET_CHANNEL_LIMITS _IOW(MSG_SLOT_IOC_MAGIC, 18, struct msg_slot_limits)
+#define MSG_SLOT_READ_AT _IOWR(MSG_SLOT_IOC_MAGIC, 19, struct msg_slot_read_at)
+#define MSG_SLOT_SET_READ_MODE _IOW(MSG_SLOT_IOC_MAGIC, 20, unsigned int)
+#define MSG_SLOT_SET_COMPRESSION _IOW(MSG_SLOT_IOC_MAGIC, 21, unsigned int)
+#define MSG_SLOT_WRITE_MANY _IOWR(MSG_SLOT_IOC_MAGIC, 22, struct msg_slot_write_many)
+
+// Longest message a channel can hold. The module's max_message_len parameter sets the
+// limit in force, 4 MiB by default.
+// splice() moves one message per call and the message has to fit in the pipe, 64 KiB
+// unless raised with F_SETPIPE_SZ. A longer splice or sendfile() into a channel fails
+// with EMSGSIZE.
+#define MSG_SLOT_MAX_MESSAGE_LEN (16 << 20)
+
+// Special values for MSG_SLOT_SET_NUMA_NODE, a value >= 0 pins the slot to that node
+#define MSG_SLOT_NUMA_LOCAL (-1)         // Allocate on the node of the allocating CPU (default)
+#define MSG_SLOT_NUMA_FIRST_WRITER (-2)  // Pin the slot to the node of the first channel creator
+
+/**
+ * Values for MSG_SLOT_SET_READ_MODE, set per open file.
+ *
+ * In stream mode a read copies as much of the message as fits from the file position
+ * and advances it, and returns 0 once the whole message was read. A new message written
+ * to the channel restarts the position at 0. On a broadcast channel the 0 that ends a
+ * message also moves the file to the next logged message. A file in stream mode should
+ * be read by one thread at a time, as the position is not locked.
+ */
+#define MSG_SLOT_READ_WHOLE 0    // A read returns the whole message or fails with ENOSPC (default)
+#define MSG_SLOT_READ_STREAM 1   // Reads move through the message by the file position
+
+// Flags for struct msg_slot_list
+#define MSG_SLOT_LIST_NONEMPTY 0x1   // Only report channels that hold a message
+
+/**
+ * One entry returned by MSG_SLOT_LIST.
+ * last_write_ns is CLOCK_REALTIME in nanoseconds, 0 if never written.
+ */
+struct msg_slot_channel_info {
+    __u32 channel_id;
+    __u32 message_len;
+    __u64 last_write_ns;
+};
+
+/**
+ * Argument of MSG_SLOT_LIST.
+ *
+ * cursor:  in  - only channels with an id greater than cursor are reported (start with 0).
+ *          out - id of the last reported channel, pass it back to get the next page.
+ * count:   in  - number of entries the user buffer can hold.
+ *          out - number of entries filled. A short page means the walk is done.
+ * flags:   MSG_SLOT_LIST_* flags.
+ * entries: user pointer to an array of struct msg_slot_channel_info.
+ */
+struct msg_slot_list {
+    __u32 cursor;
+    __u32 count;
+    __u32 flags;
+    __u32 reserved;
+    __u64 entries;
+};
+
+/**
+ * Filled by MSG_SLOT_STATS.
+ * mem_used is the kernel memory charged to the slot in bytes, mem_quota its limit (0 if unlimited).
+ * ttl_seconds is the idle time after which channels are evicted, 0 if eviction is off.
+ * numa_node is the node channels are allocated on, or one of the MSG_SLOT_NUMA_* values.
+ * channel_soft_limit and channel_hard_limit are the slot's channel limits (0 if unlimited).
+ * compress_threshold is the length past which messages are LZ4 compressed, 0 if off.
+ * compressed_in and compressed_out are the bytes of the messages stored compressed before
+ * and after compression, their ratio is the saving. compress_ns and decompress_ns are the
+ * time spent compressing, including messages that did not shrink enough to be kept
+ * compressed, and decompressing for readers. A reader's decompressed copy counts in
+ * mem_used while the read lasts, so reading a compressed message can fail with EDQUOT.
+ */
+struct msg_slot_stats {
+    __u64 channel_count;
+    __u64 evicted_channels;
+    __u64 mem_used;
+    __u64 mem_quota;
+    __u32 ttl_seconds;
+    __s32 numa_node;
+    __u64 channel_soft_limit;
+    __u64 channel_hard_limit;
+    __u32 compress_threshold;
+    __u32 reserved;
+    __u64 compressed_in;
+    __u64 compressed_out;
+    __u64 compress_ns;
+    __u64 decompress_ns;
+};
+
+/**
+ * Argument of MSG_SLOT_SET_CHANNEL_LIMITS, 0 disables a limit.
+ * Creating a channel past the hard limit fails with ENOSPC, past the soft limit it
+ * succeeds but is reported in the kernel log. The soft limit must not exceed a set hard
+ * limit. Limits below the current number of channels only stop further creations.
+ */
+struct msg_slot_limits {
+    __u64 soft;
+    __u64 hard;
+};
+
+#define MSG_SLOT_BROADCAST_MAX_DEPTH 4096
+
+/**
+ * Argument of MSG_SLOT_SET_BROADCAST.
+ * A depth between 1 and MSG_SLOT_BROADCAST_MAX_DEPTH keeps the last depth messages of the
+ * channel in a log that every open file reads through its own cursor, 0 turns the channel
+ * back into a plain overwrite channel. Changing the depth drops the current log.
+ */
+struct msg_slot_broadcast {
+    __u32 channel_id;
+    __u32 depth;
+};
+
+/**
+ * Argument of MSG_SLOT_READ_IF_NEWER.
+ *
+ * Every write gives the channel a new sequence number greater than any it had before,
+ * also across deletion and recreation of the channel.
+ *
+ * channel_id: channel to read, 0 for the channel selected on the file.
+ * len:        in  - size of the user buffer.
+ *             out - length of the message copied, 0 if the channel holds nothing newer
+ *                   than seq. On ENOSPC the length the buffer needs.
+ * seq:        in  - last sequence number the caller has seen, 0 for none.
+ *             out - sequence number of the channel's current message.
+ * buf:        user pointer to the message buffer.
+ */
+struct msg_slot_read {
+    __u32 channel_id;
+    __u32 len;
+    __u64 seq;
+    __u64 buf;
+};
+
+/**
+ * Argument of MSG_SLOT_READ_AT, reads part of a channel's message.
+ *
+ * A large message can be read in chunks: pass seq 0 for the first chunk and the returned
+ * seq for the others, so a chunk of a message that was replaced in between fails with
+ * ESTALE instead of mixing two messages.
+ *
+ * channel_id:  channel to read, 0 for the channel selected on the file.
+ * offset:      position in the message to read from.
+ * buf:         user pointer to the buffer.
+ * len:         in  - size of the buffer.
+ *              out - bytes copied, 0 at or past the end of the message.
+ * seq:         in  - sequence number the message must have, 0 for any.
+ *              out - sequence number of the message read.
+ * message_len: out - length of the whole message.
+ */
+struct msg_slot_read_at {
+    __u32 channel_id;
+    __u32 reserved;
+    __u64 offset;
+    __u64 buf;
+    __u64 len;
+    __u64 seq;
+    __u64 message_len;
+};
+
+/**
+ * Argument of MSG_SLOT_CAS.
+ *
+ * The message is written only if the channel's sequence number equals expected_seq,
+ * 0 standing for a channel that holds no message. Otherwise the ioctl fails with ESTALE.
+ *
+ * channel_id:   channel to write, 0 for the channel selected on the file.
+ * len:          length of the message, 1 to max_message_len bytes.
+ * expected_seq: sequence number the channel must have.
+ * buf:          user pointer to the message.
+ * seq:          out - the new sequence number, or the current one on ESTALE.
+ */
+struct msg_slot_cas {
+    __u32 channel_id;
+    __u32 len;
+    __u64 expected_seq;
+    __u64 buf;
+    __u64 seq;
+};
+
+#define MSG_SLOT_TXN_MAX 64     // Channels per transaction
+
+/**
+ * One channel of a MSG_SLOT_TXN_WRITE or MSG_SLOT_TXN_READ.
+ *
+ * len: write - length of the message, 1 to max_message_len bytes.
+ *      read  - in: size of the buffer, out: length of the message (0 if none).
+ * buf: user pointer to the message buffer.
+ * seq: out - sequence number of the message written or read.
+ */
+struct msg_slot_txn_entry {
+    __u32 channel_id;
+    __u32 len;
+    __u64 buf;
+    __u64 seq;
+};
+
+/**
+ * Argument of MSG_SLOT_TXN_WRITE and MSG_SLOT_TXN_READ.
+ *
+ * A transaction write replaces the messages of all its channels at once, and a
+ * transaction read of the same slot sees either all or none of its messages.
+ *
+ * count:      number of entries, 1 to MSG_SLOT_TXN_MAX.
+ * entries:    user pointer to an array of struct msg_slot_txn_entry.
+ * generation: out - number of transactions committed in the slot up to and including
+ *             this one (write) or the last one the snapshot includes (read).
+ */
+struct msg_slot_txn {
+    __u32 count;
+    __u32 reserved;
+    __u64 entries;
+    __u64 generation;
+};
+
+#define MSG_SLOT_WRITE_MANY_MAX 65536  // Channels per MSG_SLOT_WRITE_MANY call
+
+/**
+ * Argument of MSG_SLOT_WRITE_MANY, writes one message to many channels.
+ *
+ * The message is copied in, and compressed if the slot asks for it, once, and every
+ * channel refers to that one copy, charged to the slot once. A later write to one of the
+ * channels replaces only that channel's message. A message short enough to be stored in
+ * the channel itself is still copied to each channel, at no extra memory. The channels
+ * are written one after another, not at once like MSG_SLOT_TXN_WRITE.
+ *
+ * count:       in  - number of channel IDs, 1 to MSG_SLOT_WRITE_MANY_MAX.
+ *              out - number of channels written, the first ones of the array, also on error.
+ * len:         length of the message, 1 to max_message_len bytes.
+ * buf:         user pointer to the message.
+ * channel_ids: user pointer to an array of count __u32 channel IDs, none of them 0.
+ */
+struct msg_slot_write_many {
+    __u32 count;
+    __u32 len;
+    __u64 buf;
+    __u64 channel_ids;
+};
+
+/**
+ * Snapshot stream record: a header followed by message_len bytes of message, padded
+ * so that the next record starts on an 8 byte boundary.
+ */
+struct msg_slot_record {
+    __u32 channel_id;
+    __u32 message_len;
+};
+
+#define MSG_SLOT_RECORD_SIZE(len) ((sizeof(struct msg_slot_record) + (len) + 7) & ~(__u64)7)
+
+// Flags of struct msg_slot_snapshot
+#define MSG_SLOT_SNAPSHOT_END 0x1    // Out - the export reached the last channel
+
+/**
+ * Argument of MSG_SLOT_EXPORT and MSG_SLOT_IMPORT.
+ *
+ * MSG_SLOT_EXPORT fills buf with records of the channels that hold a message, in
+ * channel ID order, starting after cursor. Call it again with the returned cursor until
+ * MSG_SLOT_SNAPSHOT_END is set. MSG_SLOT_IMPORT writes every complete record of buf to
+ * its channel; a trailing partial record is left for the next call. A record larger than
+ * buf is never produced or consumed, a buffer of MSG_SLOT_RECORD_SIZE(max_message_len)
+ * bytes always makes progress.
+ *
+ * cursor: export - in: last channel ID already exported (0 to start), out: last ID covered.
+ * flags:  out - MSG_SLOT_SNAPSHOT_* flags.
+ * buf:    user pointer to the record stream.
+ * len:    in - size of buf, out - bytes produced (export) or consumed (import).
+ * count:  out - number of records produced or consumed.
+ */
+struct msg_slot_snapshot {
+    __u32 cursor;
+    __u32 flags;
+    __u64 buf;
+    __u64 len;
+    __u64 count;
+};
+
+#define MSG_SLOT_WATCH_MAX 1024  // Channels per MSG_SLOT_WATCH_EVENTFD call
+
+/**
+ * Argument of MSG_SLOT_WATCH_EVENTFD and MSG_SLOT_UNWATCH_EVENTFD.
+ *
+ * Watching makes every write to one of the channels add 1 to the eventfd, so one eventfd
+ * can wake an event loop for any number of channels. Watches belong to the file that
+ * made them and go away when it is closed.
+ *
+ * fd:          the eventfd.
+ * count:       number of channel IDs, 1 to MSG_SLOT_WATCH_MAX.
+ * channel_ids: user pointer to an array of __u32 channel IDs.
+ */
+struct msg_slot_eventfd {
+    __s32 fd;
+    __u32 count;
+    __u64 channel_ids;
+};
+
+/**
+ * Argument of MSG_SLOT_SUBSCRIBE and MSG_SLOT_UNSUBSCRIBE.
+ *
+ * MSG_SLOT_SUBSCRIBE with fd set to -1 creates a notification fd watching the channels
+ * and returns it, with a notification fd of the same slot it adds the channels to it.
+ * read() on a notification fd returns the IDs of the watched channels written since they
+ * were last reported, as an array of __u32, each channel at most once however often it
+ * was written. It blocks while nothing changed unless the fd is non-blocking, and polls
+ * readable when something did. MSG_SLOT_UNSUBSCRIBE removes channels from it.
+ *
+ * fd:          notification fd, or -1 to create one.
+ * count:       number of channel IDs, 1 to MSG_SLOT_WATCH_MAX.
+ * channel_ids: user pointer to an array of __u32 channel IDs.
+ */
+struct msg_slot_subscribe {
+    __s32 fd;
+    __u32 count;
+    __u64 channel_ids;
+};
+
+#ifdef __KERNEL__
+
+#include <linux/xarray.h>
+#include <linux/refcount.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/kdev_t.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+
+#define MSG_SLOT_MAX_MINORS (1U << MINORBITS)    // Upper bound of the nr_minors parameter
+#define MSG_SLOT_LOCK_BITS 6
+#define MSG_SLOT_LOCK_STRIPES (1 << MSG_SLOT_LOCK_BITS)
+#define MSG_SLOT_INLINE_LEN 128         // Longer messages are stored out of line
+#define MSG_SLOT_PAYLOAD_CLASSES 6      // Payload size classes, MSG_SLOT_INLINE_LEN << i bytes
+#define MSG_SLOT_PAYLOAD_LARGE MSG_SLOT_PAYLOAD_CLASSES // Size class of a kvmalloc'ed payload
+
+// Failures counted by report_error(), shown in /sys/class/message_slot/errors
+enum message_slot_error {
+    MSG_SLOT_ERR_OPEN_NOMEM,        // Opens that could not allocate their state
+    MSG_SLOT_ERR_CHANNEL_NOMEM,     // Channel or message allocations that failed
+    MSG_SLOT_ERR_CHANNEL_LIMIT,     // Channel creations refused by the hard limit
+    MSG_SLOT_ERR_SOFT_LIMIT,        // Channel creations past the soft limit
+    MSG_SLOT_ERR_QUOTA,             // Allocations refused by a slot's memory quota
+    MSG_SLOT_NR_ERRORS
+};
+
+// A message stored out of line or kept in a broadcast log, shared by every channel and
+// reader that holds it. Never changed once written, a write installs a new payload.
+struct message_payload {
+    refcount_t refs;            // One per channel and log holding it, one per reader copying it out
+    unsigned int size_class;    // Cache it came from, see alloc_payload()
+    unsigned int packed_len;    // Bytes of LZ4 data in data, 0 if the message is stored as is
+    size_t len;                 // Length of the message
+    u64 serial;                 // Unique in the slot when packed, keys the readers' caches
+    char data[];
+};
+
+// Ring of the last depth messages of a broadcast channel, entry seq lives at seq % depth
+struct message_log {
+    u64 head;                   // Sequence number of the next message appended
+    unsigned int depth;
+    struct message_payload *entries[];
+};
 
 struct message_channel {
     unsigned int channel_id;
-    char message[128];
+    char message[MSG_SLOT_INLINE_LEN];  // The message, unless it is too long to fit
+    struct message_payload *payload;    // Out of line message, NULL if it is inline
     size_t message_len;
-    struct message_channel *next;
+    u64 last_write_ns;
+    u64 seq;                    // Version of the message, see next_seq()
+    unsigned long last_access;  // jiffies of the last select/read/write, see touch_channel()
+    struct message_log *log;    // Broadcast log, NULL for a plain channel
+    struct message_slot *slot;  // Owner, charged for the channel's memory
+    refcount_t refs;            // One for the slot index, one per read/write in progress
+    struct rcu_head rcu;        // Deferred free, lookups run under RCU
 };
 
 struct message_slot {
-    struct message_channel *channels;
-    unsigned long channel_count;
+    struct xarray channels;     // channel_id -> struct message_channel
+    atomic_long_t channel_count;
+    unsigned int ttl;           // Idle seconds before a channel is evicted, 0 disables eviction
+    atomic_long_t evicted;      // Channels reclaimed by the eviction worker
+    atomic_long_t mem_used;     // Bytes charged by charge_slot()
+    unsigned long mem_quota;    // Byte budget of the slot, 0 for unlimited
+    unsigned long channel_soft_limit;   // Channels past which creation is logged, 0 for none
+    unsigned long channel_hard_limit;   // Channels past which creation fails, 0 for none
+    int numa_node;              // Node or MSG_SLOT_NUMA_* policy, see slot_node()
+    unsigned int compress_threshold;    // Longer messages are compressed, 0 for none
+    atomic64_t compressed_in;   // Bytes of the messages stored compressed, before compression
+    atomic64_t compressed_out;  // and after
+    atomic64_t compress_ns;     // Time spent in LZ4 compression
+    atomic64_t decompress_ns;   // and decompression
+    atomic64_t packed_serial;   // Last serial given to a compressed payload
+    struct delayed_work evict_work;
+    spinlock_t locks[MSG_SLOT_LOCK_STRIPES];    // See channel_lock()
+    struct mutex txn_lock;      // Serializes transaction writers
+    seqcount_mutex_t txn_seq;   // Bumped around every transaction commit
+    struct xarray watches;      // channel_id -> struct message_watch_list
+    struct mutex watch_lock;    // Serializes changes of the watch lists
     int minor;
-    struct message_slot *next;
 };
 
+// A message replacement in progress, see prepare_update()
+struct message_update {
+    struct message_channel *channel;    // Referenced until finish_update()
+    struct message_payload *payload;    // Out of line message and log entry, or NULL
+    struct message_payload *old_message;    // Out of line message replaced by the commit
+    struct message_payload *old_entry;      // Broadcast log entry the commit overwrote
+    const char *data;
+    size_t len;
+    bool written;                       // Set by commit_update() once the message changed
+};
+
+// A decompressed message, see unpack_copy(). A file keeps the one it reads in parts, see unpack_cached()
+struct message_unpacked {
+    u64 serial;                 // Serial of the payload it came from
+    size_t size;                // Bytes charged to the slot
+    char data[];
+};
 
-#endif /* MESSAGE_SLOT_H */
+// A message taken out of a channel to be copied without the channel's lock, see copy_message()
+struct message_copy {
+    const char *data;                   // inline_data, the payload's data or unpacked->data
+    struct message_payload *payload;    // Referenced until release_copy(), or NULL
+    struct message_unpacked *unpacked;  // Decompressed message, see unpack_copy()
+    size_t len;
+    u64 seq;
+    char inline_data[MSG_SLOT_INLINE_LEN];
+};
 
+// The watches of one channel, see notify_watchers()
+struct message_watch_list {
+    struct list_head watches;   // Of struct message_watch, walked under RCU
+    struct rcu_head rcu;
+};
+
+// Changed channels of a notification fd, see subscribe()
+struct message_queue {
+    struct message_slot *slot;
+    spinlock_t lock;            // Protects pending and the watches' pending_node
+    struct list_head pending;   // Watches of channels written since last read, oldest first
+    wait_queue_head_t wait;     // Readers waiting for a change
+    struct list_head watches;   // Of the queue, under the slot's watch_lock
+    struct rcu_head rcu;
+};
+
+// Reports every write to a channel, see notify_watchers()
+struct message_watch {
+    struct list_head node;          // In the channel's struct message_watch_list
+    struct list_head owner_node;    // In the watches of its file or queue
+    const void *owner;              // The struct message_file or struct message_queue
+    unsigned int channel_id;
+    struct eventfd_ctx *eventfd;    // Signalled and referenced by the watch, or NULL
+    struct message_queue *queue;    // Or the queue the channel is reported to
+    struct list_head pending_node;  // In the queue's pending list, under its lock
+    bool removed;                   // Unlinked, no longer queued, under the queue's lock
+    struct rcu_head rcu;
+};
+
+// One channel of a transaction read, see txn_read()
+struct message_snapshot_entry {
+    struct message_channel *channel;
+    struct message_copy copy;
+};
+
+// Per open file state, stored in file->private_data
+struct message_file {
+    struct message_slot *slot;
+    unsigned int channel_id;    // Selected by MSG_SLOT_CHANNEL, 0 until then
+    u64 log_cursor;             // Next broadcast log entry this file reads
+    bool stream;                // MSG_SLOT_READ_STREAM, the file position tracks the message read
+    u64 stream_seq;             // Sequence number of the message the file position belongs to
+    struct message_unpacked *unpacked;  // Compressed message read in parts, until its end
+    struct list_head watches;   // Watches made through this file, under the slot's watch_lock
+};
+
+#endif /* __KERNEL__ */
+
+#endif /* MESSAGE_SLOT_H */
@@ -0,0 +1,142 @@
+#include <fcntl.h>      // For open()
+#include <stdio.h>      // For perror() and fprintf()
+#include <stdlib.h>     // For exit(), malloc() and EXIT_FAILURE
+#include <string.h>     // For strcmp(), memcmp() and memmove()
+#include <stdint.h>     // For uintptr_t
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For read(), write() and close()
+#include "message_slot.h"
+
+// Bytes moved per MSG_SLOT_EXPORT/IMPORT call, enough for a record of the longest message
+#define CHUNK_SIZE MSG_SLOT_RECORD_SIZE(MSG_SLOT_MAX_MESSAGE_LEN)
+#define SNAPSHOT_MAGIC "MSLTSNP1"   // File header, followed by the record stream
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+// Writes all of buf to fd, retrying short writes
+static void write_all(int fd, const char *buf, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            fail("Error writing snapshot file");
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static void export_slot(int dev, int out, char *buf) {
+    struct msg_slot_snapshot snap;
+    unsigned long long records = 0;
+
+    memset(&snap, 0, sizeof(snap));
+    snap.buf = (uintptr_t)buf;
+    write_all(out, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC));
+
+    // The kernel advances the cursor for us until it reports the end of the slot
+    do {
+        snap.len = CHUNK_SIZE;
+        if (ioctl(dev, MSG_SLOT_EXPORT, &snap) != 0) {
+            fail("Error exporting slot");
+        }
+        write_all(out, buf, snap.len);
+        records += snap.count;
+    } while (!(snap.flags & MSG_SLOT_SNAPSHOT_END));
+
+    fprintf(stderr, "Exported %llu channels\n", records);
+}
+
+static void import_slot(int dev, int in, char *buf) {
+    struct msg_slot_snapshot snap;
+    unsigned long long records = 0;
+    char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+    size_t have = 0;
+    ssize_t n;
+
+    if (read(in, magic, sizeof(magic)) != sizeof(magic) ||
+        memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "Not a message slot snapshot\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&snap, 0, sizeof(snap));
+    snap.buf = (uintptr_t)buf;
+
+    for (;;) {
+        n = read(in, buf + have, CHUNK_SIZE - have);
+        if (n < 0) {
+            fail("Error reading snapshot file");
+        }
+        have += n;
+        if (have == 0) {
+            break;
+        }
+        if (n == 0 && have < sizeof(struct msg_slot_record)) {
+            fprintf(stderr, "Truncated snapshot file\n");
+            exit(EXIT_FAILURE);
+        }
+
+        snap.len = have;
+        if (ioctl(dev, MSG_SLOT_IMPORT, &snap) != 0) {
+            fail("Error importing slot");
+        }
+        records += snap.count;
+
+        // Keep a record cut off by the chunk end for the next call
+        if (snap.len == 0 && n == 0) {
+            fprintf(stderr, "Truncated snapshot file\n");
+            exit(EXIT_FAILURE);
+        }
+        memmove(buf, buf + snap.len, have - snap.len);
+        have -= snap.len;
+    }
+
+    fprintf(stderr, "Imported %llu channels\n", records);
+}
+
+int main(int argc, char *argv[]) {
+    int dev;
+    int file;
+    int exporting;
+    char *buf;
+
+    // Validate the command-line arguments
+    if (argc != 4 || (strcmp(argv[1], "export") != 0 && strcmp(argv[1], "import") != 0)) {
+        fprintf(stderr, "Usage: %s export|import <device file path> <snapshot file>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    exporting = strcmp(argv[1], "export") == 0;
+
+    // Open the specified message slot device file
+    dev = open(argv[2], exporting ? O_RDONLY : O_WRONLY);
+    if (dev < 0) {
+        fail("Error opening device file");
+    }
+
+    file = exporting ? open(argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(argv[3], O_RDONLY);
+    if (file < 0) {
+        fail("Error opening snapshot file");
+    }
+
+    buf = malloc(CHUNK_SIZE);
+    if (!buf) {
+        fail("Error allocating buffer");
+    }
+
+    if (exporting) {
+        export_slot(dev, file, buf);
+    } else {
+        import_slot(dev, file, buf);
+    }
+
+    free(buf);
+    close(file);
+    close(dev);
+
+    return 0;
+}
@@ -0,0 +1,254 @@
+#include <fcntl.h>      // For open()
+#include <errno.h>      // For errno and ENOSPC
+#include <pthread.h>    // For pthread_create() and pthread_join()
+#include <stdio.h>      // For perror(), printf(), fprintf(), fopen() and fscanf()
+#include <stdlib.h>     // For exit(), calloc(), strtoul() and EXIT_FAILURE
+#include <time.h>       // For clock_gettime()
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For write() and close()
+#include "message_slot.h"
+
+// Failure storm test: caps an empty slot at one channel and has several threads try to
+// create channels past the limit millions of times, while one thread keeps writing to
+// the channel that exists. Compares that writer's throughput with and without the storm
+// and checks the channel_limit counter in sysfs saw every failure. Needs CAP_SYS_ADMIN
+// to set the channel limits, which are restored afterwards.
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_FAILURES 1000000   // Failed creations per storm thread
+#define BASELINE_SECONDS 2         // Length of the writer's run without the storm
+#define HEALTHY_ID 1               // The channel the writer keeps writing
+#define COUNTER_PATH "/sys/class/message_slot/errors/channel_limit"
+
+struct storm {
+    pthread_t thread;
+    const char *path;
+    unsigned int first_id;
+    unsigned long failures;
+    unsigned long unexpected;   // Creations that did not fail with ENOSPC
+};
+
+struct writer {
+    pthread_t thread;
+    const char *path;
+    unsigned long writes;
+    unsigned long errors;
+    int stop;
+};
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long read_counter(void) {
+    unsigned long value;
+    FILE *f;
+
+    f = fopen(COUNTER_PATH, "r");
+    if (!f) {
+        fail("Error opening " COUNTER_PATH);
+    }
+    if (fscanf(f, "%lu", &value) != 1) {
+        fprintf(stderr, "Error reading " COUNTER_PATH "\n");
+        exit(EXIT_FAILURE);
+    }
+    fclose(f);
+    return value;
+}
+
+// Creates channels past the limit, every attempt must fail with ENOSPC
+static void *run_storm(void *arg) {
+    struct storm *s = arg;
+    unsigned long i;
+    char msg = 's';
+    int fd;
+
+    fd = open(s->path, O_WRONLY);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+
+    for (i = 0; i < s->failures; i++) {
+        if (ioctl(fd, MSG_SLOT_CHANNEL, s->first_id + i % 1000000) != 0) {
+            fail("Error setting channel id");
+        }
+        if (write(fd, &msg, 1) != -1 || errno != ENOSPC) {
+            s->unexpected++;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+// Keeps writing to the channel that exists until told to stop
+static void *run_writer(void *arg) {
+    struct writer *w = arg;
+    char msg[64] = "healthy";
+    int fd;
+
+    fd = open(w->path, O_WRONLY);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    if (ioctl(fd, MSG_SLOT_CHANNEL, HEALTHY_ID) != 0) {
+        fail("Error setting channel id");
+    }
+
+    while (!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+        if (write(fd, msg, sizeof(msg)) != sizeof(msg)) {
+            w->errors++;
+        }
+        w->writes++;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static void start_writer(struct writer *w, const char *path) {
+    w->path = path;
+    w->writes = 0;
+    w->errors = 0;
+    w->stop = 0;
+    if (pthread_create(&w->thread, NULL, run_writer, w) != 0) {
+        fprintf(stderr, "Error creating thread\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void stop_writer(struct writer *w) {
+    __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(w->thread, NULL);
+    if (w->errors) {
+        fprintf(stderr, "%lu writes to the existing channel failed\n", w->errors);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct msg_slot_stats stats;
+    struct msg_slot_limits limits;
+    struct writer writer;
+    struct storm *storms;
+    unsigned int threads = DEFAULT_THREADS;
+    unsigned long failures = DEFAULT_FAILURES;
+    unsigned long counted;
+    unsigned long unexpected = 0;
+    unsigned int t;
+    double start;
+    double baseline;
+    double storm_s;
+    double loaded;
+    char msg = 'h';
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <device file path> [threads] [failures per thread]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        threads = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        failures = strtoul(argv[3], NULL, 10);
+    }
+    if (threads == 0 || failures == 0) {
+        fprintf(stderr, "Need at least 1 thread and 1 failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    if (ioctl(fd, MSG_SLOT_STATS, &stats) != 0) {
+        fail("Error reading slot stats");
+    }
+    if (stats.channel_count != 0) {
+        fprintf(stderr, "The slot must be empty\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Cap the slot at the one channel the writer uses
+    limits.soft = 0;
+    limits.hard = 1;
+    if (ioctl(fd, MSG_SLOT_SET_CHANNEL_LIMITS, &limits) != 0) {
+        fail("Error setting channel limits");
+    }
+    if (ioctl(fd, MSG_SLOT_CHANNEL, HEALTHY_ID) != 0 || write(fd, &msg, 1) != 1) {
+        fail("Error creating the writer's channel");
+    }
+
+    // The writer alone
+    start_writer(&writer, argv[1]);
+    sleep(BASELINE_SECONDS);
+    stop_writer(&writer);
+    baseline = writer.writes / (double)BASELINE_SECONDS;
+
+    storms = calloc(threads, sizeof(*storms));
+    if (!storms) {
+        fail("Error allocating threads");
+    }
+    counted = read_counter();
+
+    // The writer next to the storm
+    start = now();
+    start_writer(&writer, argv[1]);
+    for (t = 0; t < threads; t++) {
+        storms[t].path = argv[1];
+        storms[t].first_id = HEALTHY_ID + 1 + t * 1000000;
+        storms[t].failures = failures;
+        if (pthread_create(&storms[t].thread, NULL, run_storm, &storms[t]) != 0) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (t = 0; t < threads; t++) {
+        pthread_join(storms[t].thread, NULL);
+        unexpected += storms[t].unexpected;
+    }
+    stop_writer(&writer);
+    storm_s = now() - start;
+    loaded = writer.writes / storm_s;
+    counted = read_counter() - counted;
+
+    // Restore the slot
+    limits.soft = stats.channel_soft_limit;
+    limits.hard = stats.channel_hard_limit;
+    if (ioctl(fd, MSG_SLOT_SET_CHANNEL_LIMITS, &limits) != 0) {
+        fail("Error restoring channel limits");
+    }
+    if (ioctl(fd, MSG_SLOT_DELETE, HEALTHY_ID) != 0) {
+        fail("Error deleting the writer's channel");
+    }
+
+    printf("%lu failed creations by %u threads in %.2f s, %.0f failures/s\n", failures * threads, threads,
+           storm_s, failures * threads / storm_s);
+    printf("Writer: %.0f writes/s alone, %.0f writes/s during the storm (%.0f%%)\n", baseline, loaded,
+           100 * loaded / baseline);
+
+    if (unexpected) {
+        fprintf(stderr, "%lu creations past the limit did not fail with ENOSPC\n", unexpected);
+        exit(EXIT_FAILURE);
+    }
+    if (counted < failures * threads) {
+        fprintf(stderr, "channel_limit counted %lu of %lu failures\n", counted, failures * threads);
+        exit(EXIT_FAILURE);
+    }
+
+    free(storms);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,231 @@
+#include <fcntl.h>      // For open()
+#include <errno.h>      // For errno and ENOENT
+#include <pthread.h>    // For pthread_create() and pthread_join()
+#include <stdio.h>      // For perror(), printf() and fprintf()
+#include <stdlib.h>     // For exit(), calloc(), strtoul() and EXIT_FAILURE
+#include <string.h>     // For memset()
+#include <stdint.h>     // For uint32_t and uintptr_t
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For read(), write() and close()
+#include "message_slot.h"
+
+// Concurrently creates a large number of channels in an empty slot, every ID by two
+// threads at once, and checks that each ID exists exactly once afterwards holding the
+// message written to it. The channels are then deleted concurrently and the slot must
+// be empty again. Runs several rounds so deleted IDs are created anew.
+
+#define DEFAULT_THREADS 8
+#define DEFAULT_IDS 1000000   // Below the default channel hard limit of 2^20
+#define DEFAULT_ROUNDS 3
+#define PAGE_ENTRIES 1024     // Channels requested per MSG_SLOT_LIST call
+
+struct worker {
+    pthread_t thread;
+    const char *path;
+    unsigned int index;
+    unsigned int threads;
+    unsigned int ids;
+    int deleting;
+    unsigned long errors;
+};
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+// Thread t handles the IDs i with i % threads == t or (i + 1) % threads == t, so every
+// ID is written, and then deleted, by two threads racing on it
+static void *run_worker(void *arg) {
+    struct worker *w = arg;
+    unsigned int id;
+    uint32_t msg;
+    int fd;
+
+    fd = open(w->path, O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+
+    for (id = 1; id <= w->ids; id++) {
+        if (id % w->threads != w->index && (id + 1) % w->threads != w->index) {
+            continue;
+        }
+        if (w->deleting) {
+            // Only one of the two racing threads finds the channel
+            if (ioctl(fd, MSG_SLOT_DELETE, id) != 0 && errno != ENOENT) {
+                w->errors++;
+            }
+            continue;
+        }
+        msg = id;
+        if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0 || write(fd, &msg, sizeof(msg)) != sizeof(msg)) {
+            w->errors++;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static void run_workers(struct worker *workers, unsigned int threads, int deleting) {
+    unsigned int t;
+
+    for (t = 0; t < threads; t++) {
+        workers[t].deleting = deleting;
+        if (pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]) != 0) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        if (workers[t].errors) {
+            fprintf(stderr, "Thread %u: %lu failed %s\n", t, workers[t].errors,
+                    deleting ? "deletions" : "writes");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static unsigned long long channel_count(int fd) {
+    struct msg_slot_stats stats;
+
+    if (ioctl(fd, MSG_SLOT_STATS, &stats) != 0) {
+        fail("Error reading slot stats");
+    }
+    return stats.channel_count;
+}
+
+// Walks the slot and checks that it holds exactly the IDs 1 to ids, each once and each
+// holding its own ID as message. Returns the number of problems found.
+static unsigned long verify(int fd, unsigned int ids) {
+    struct msg_slot_channel_info entries[PAGE_ENTRIES];
+    struct msg_slot_list list;
+    unsigned char *seen;
+    unsigned long bad = 0;
+    unsigned int listed = 0;
+    unsigned int last = 0;
+    unsigned int id;
+    unsigned int i;
+    uint32_t msg;
+
+    seen = calloc(ids + 1, 1);
+    if (!seen) {
+        fail("Error allocating bitmap");
+    }
+
+    memset(&list, 0, sizeof(list));
+    list.entries = (uintptr_t)entries;
+    do {
+        list.count = PAGE_ENTRIES;
+        if (ioctl(fd, MSG_SLOT_LIST, &list) != 0) {
+            fail("Error listing channels");
+        }
+        for (i = 0; i < list.count; i++) {
+            id = entries[i].channel_id;
+            if (id <= last || id > ids || seen[id]) {
+                fprintf(stderr, "Duplicate or unexpected channel %u\n", id);
+                bad++;
+                continue;
+            }
+            seen[id] = 1;
+            last = id;
+            listed++;
+        }
+    } while (list.count == PAGE_ENTRIES);
+
+    for (id = 1; id <= ids; id++) {
+        if (!seen[id]) {
+            fprintf(stderr, "Lost channel %u\n", id);
+            bad++;
+            continue;
+        }
+        if (ioctl(fd, MSG_SLOT_CHANNEL, id) != 0 || read(fd, &msg, sizeof(msg)) != sizeof(msg) ||
+            msg != id) {
+            fprintf(stderr, "Channel %u does not hold its message\n", id);
+            bad++;
+        }
+    }
+
+    if (channel_count(fd) != listed) {
+        fprintf(stderr, "Slot counts %llu channels, %u listed\n", channel_count(fd), listed);
+        bad++;
+    }
+
+    free(seen);
+    return bad;
+}
+
+int main(int argc, char *argv[]) {
+    struct worker *workers;
+    unsigned int threads = DEFAULT_THREADS;
+    unsigned int ids = DEFAULT_IDS;
+    unsigned int rounds = DEFAULT_ROUNDS;
+    unsigned int round;
+    unsigned int t;
+    unsigned long bad;
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 5) {
+        fprintf(stderr, "Usage: %s <device file path> [threads] [ids] [rounds]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        threads = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        ids = strtoul(argv[3], NULL, 10);
+    }
+    if (argc > 4) {
+        rounds = strtoul(argv[4], NULL, 10);
+    }
+    if (threads < 2 || ids == 0 || rounds == 0) {
+        fprintf(stderr, "Need at least 2 threads, 1 ID and 1 round\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    if (channel_count(fd) != 0) {
+        fprintf(stderr, "The slot must be empty\n");
+        exit(EXIT_FAILURE);
+    }
+
+    workers = calloc(threads, sizeof(*workers));
+    if (!workers) {
+        fail("Error allocating threads");
+    }
+    for (t = 0; t < threads; t++) {
+        workers[t].path = argv[1];
+        workers[t].index = t;
+        workers[t].threads = threads;
+        workers[t].ids = ids;
+    }
+
+    for (round = 1; round <= rounds; round++) {
+        run_workers(workers, threads, 0);
+        bad = verify(fd, ids);
+        if (bad) {
+            fprintf(stderr, "Round %u: %lu problems\n", round, bad);
+            exit(EXIT_FAILURE);
+        }
+
+        run_workers(workers, threads, 1);
+        if (channel_count(fd) != 0) {
+            fprintf(stderr, "Round %u: %llu channels left after deletion\n", round, channel_count(fd));
+            exit(EXIT_FAILURE);
+        }
+        printf("Round %u: %u channels created by %u threads, no duplicates or losses\n", round, ids,
+               threads);
+    }
+
+    free(workers);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include <fcntl.h>      // For open()
+#include <pthread.h>    // For pthread_create() and pthread_join()
+#include <stdio.h>      // For perror(), printf() and fprintf()
+#include <stdlib.h>     // For exit(), calloc(), free(), strtoul() and EXIT_FAILURE
+#include <stdint.h>     // For uint64_t and uintptr_t
+#include <sys/ioctl.h>  // For ioctl()
+#include <unistd.h>     // For sleep() and close()
+#include "message_slot.h"
+
+// Transaction benchmark: writer threads replace the messages of the same set of channels
+// with MSG_SLOT_TXN_WRITE, every transaction writing one value to all of them, while
+// reader threads take snapshots of the set with MSG_SLOT_TXN_READ. A snapshot holding
+// different values saw part of a transaction. Reports transactions and snapshots per
+// second and fails on any torn snapshot.
+
+#define DEFAULT_WRITERS 2
+#define DEFAULT_READERS 4
+#define DEFAULT_CHANNELS 8
+#define DEFAULT_SECONDS 10
+
+struct worker {
+    pthread_t thread;
+    const char *path;
+    unsigned int channels;
+    int reading;
+    uint64_t first_value;   // Writers write first_value, first_value + 1, ...
+    unsigned long done;     // Transactions or snapshots
+    unsigned long torn;     // Snapshots mixing two transactions
+    unsigned long errors;
+    int *stop;
+};
+
+static void fail(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+static void *run_worker(void *arg) {
+    struct worker *w = arg;
+    struct msg_slot_txn_entry entries[MSG_SLOT_TXN_MAX];
+    uint64_t values[MSG_SLOT_TXN_MAX];
+    struct msg_slot_txn txn;
+    uint64_t value = w->first_value;
+    unsigned int i;
+    int fd;
+
+    fd = open(w->path, O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+    txn.count = w->channels;
+    txn.reserved = 0;
+    txn.entries = (uintptr_t)entries;
+
+    while (!__atomic_load_n(w->stop, __ATOMIC_ACQUIRE)) {
+        for (i = 0; i < w->channels; i++) {
+            values[i] = value;
+            entries[i].channel_id = i + 1;
+            entries[i].len = sizeof(values[i]);
+            entries[i].buf = (uintptr_t)&values[i];
+        }
+        if (ioctl(fd, w->reading ? MSG_SLOT_TXN_READ : MSG_SLOT_TXN_WRITE, &txn) != 0) {
+            w->errors++;
+            continue;
+        }
+        if (w->reading) {
+            for (i = 1; i < w->channels; i++) {
+                if (entries[i].len != sizeof(values[i]) || values[i] != values[0]) {
+                    w->torn++;
+                    break;
+                }
+            }
+        }
+        value++;
+        w->done++;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    struct msg_slot_txn_entry entries[MSG_SLOT_TXN_MAX];
+    struct msg_slot_txn txn;
+    struct worker *workers;
+    unsigned int writers = DEFAULT_WRITERS;
+    unsigned int readers = DEFAULT_READERS;
+    unsigned int channels = DEFAULT_CHANNELS;
+    unsigned int seconds = DEFAULT_SECONDS;
+    unsigned long written = 0;
+    unsigned long snapshots = 0;
+    unsigned long torn = 0;
+    unsigned long errors = 0;
+    uint64_t zero = 0;
+    unsigned int t;
+    unsigned int i;
+    int stop = 0;
+    int fd;
+
+    // Validate the command-line arguments
+    if (argc < 2 || argc > 6) {
+        fprintf(stderr, "Usage: %s <device file path> [writers] [readers] [channels] [seconds]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2) {
+        writers = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        readers = strtoul(argv[3], NULL, 10);
+    }
+    if (argc > 4) {
+        channels = strtoul(argv[4], NULL, 10);
+    }
+    if (argc > 5) {
+        seconds = strtoul(argv[5], NULL, 10);
+    }
+    if (writers == 0 || channels < 2 || channels > MSG_SLOT_TXN_MAX || seconds == 0) {
+        fprintf(stderr, "Need at least 1 writer, 2 to %d channels and 1 second\n", MSG_SLOT_TXN_MAX);
+        exit(EXIT_FAILURE);
+    }
+
+    // Open the specified message slot device file
+    fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fail("Error opening device file");
+    }
+
+    // Start from a committed transaction so every snapshot finds all the channels
+    for (i = 0; i < channels; i++) {
+        entries[i].channel_id = i + 1;
+        entries[i].len = sizeof(zero);
+        entries[i].buf = (uintptr_t)&zero;
+    }
+    txn.count = channels;
+    txn.reserved = 0;
+    txn.entries = (uintptr_t)entries;
+    if (ioctl(fd, MSG_SLOT_TXN_WRITE, &txn) != 0) {
+        fail("Error writing the first transaction");
+    }
+
+    workers = calloc(writers + readers, sizeof(*workers));
+    if (!workers) {
+        fail("Error allocating threads");
+    }
+    for (t = 0; t < writers + readers; t++) {
+        workers[t].path = argv[1];
+        workers[t].channels = channels;
+        workers[t].reading = t >= writers;
+        workers[t].first_value = (uint64_t)t << 40; // Values of two writers never meet
+        workers[t].stop = &stop;
+        if (pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]) != 0) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+
+    for (t = 0; t < writers + readers; t++) {
+        pthread_join(workers[t].thread, NULL);
+        if (workers[t].reading) {
+            snapshots += workers[t].done;
+        } else {
+            written += workers[t].done;
+        }
+        torn += workers[t].torn;
+        errors += workers[t].errors;
+    }
+    if (ioctl(fd, MSG_SLOT_TXN_READ, &txn) != 0) {
+        fail("Error reading the generation");
+    }
+    for (i = 0; i < channels; i++) {
+        if (ioctl(fd, MSG_SLOT_DELETE, i + 1) != 0) {
+            fail("Error deleting channel");
+        }
+    }
+
+    printf("%u channels per transaction, %u writers, %u readers, %u s\n", channels, writers, readers,
+           seconds);
+    printf("Transactions: %.0f/s, snapshots: %.0f/s, slot generation %llu\n", (double)written / seconds,
+           (double)snapshots / seconds, (unsigned long long)txn.generation);
+
+    if (errors) {
+        fprintf(stderr, "%lu transactions or snapshots failed\n", errors);
+        exit(EXIT_FAILURE);
+    }
+    if (torn) {
+        fprintf(stderr, "%lu snapshots saw part of a transaction\n", torn);
+        exit(EXIT_FAILURE);
+    }
+
+    free(workers);
+    close(fd);
+
+    return 0;
+}